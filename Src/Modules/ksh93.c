@@ -84,6 +84,7 @@ matchgetfn(Param pm)
 	pm->u.arr = mkarray(ztrdup(getsparam("MATCH")));
     } else
 	pm->u.arr = NULL;
+    pm->asize = 0;
 
     return arrgetfn(pm);
 }
@@ -0,0 +1,147 @@
+/*
+ * memstats.c - report heap allocator statistics
+ *
+ * This file is part of zsh, the Z shell.
+ *
+ * Copyright (c) 2026 The Zsh Development Group
+ * All rights reserved.
+ *
+ * Permission is hereby granted, without written agreement and without
+ * license or royalty fees, to use, copy, modify, and distribute this
+ * software and to distribute modified versions of this software for any
+ * purpose, provided that the above copyright notice and the following
+ * two paragraphs appear in all copies of this software.
+ *
+ * In no event shall the Zsh Development Group be liable to any party for
+ * direct, indirect, special, incidental, or consequential damages arising
+ * out of the use of this software and its documentation, even if the Zsh
+ * Development Group have been advised of the possibility of such damage.
+ *
+ * The Zsh Development Group specifically disclaim any warranties,
+ * including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose.  The software
+ * provided hereunder is on an "as is" basis, and the Zsh Development
+ * Group have no obligation to provide maintenance, support, updates,
+ * enhancements, or modifications.
+ *
+ */
+
+#include "memstats.mdh"
+#include "memstats.pro"
+
+/*
+ * Names of the counters in struct heapstats and of those kept by the
+ * pattern cache, in the order printed
+ */
+
+static struct memstat {
+    char *name;
+    zlong *valp;
+} memstattab[] = {
+    { "arenas", &heapstats.arenas },
+    { "reused", &heapstats.reused },
+    { "freed", &heapstats.freed },
+    { "bytes", &heapstats.bytes },
+    { "peak", &heapstats.peak },
+    { "copies", &heapstats.copies },
+    { "slabnew", &heapstats.slabnew },
+    { "slabreused", &heapstats.slabreused },
+    { "slabcached", &heapstats.slabcached },
+    { "pathits", &patcache_hits },
+    { "patmisses", &patcache_misses },
+    { "patdiscards", &patcache_discards },
+    { NULL, NULL }
+};
+
+/**/
+static int
+bin_memstats(char *nam, char **args, Options ops, UNUSED(int func))
+{
+    struct memstat *ms;
+    char buf[DIGBUFSIZE];
+    int ret = 0;
+
+    if (OPT_ISSET(ops,'r')) {
+	for (ms = memstattab; ms->name; ms++)
+	    if (ms->valp != &heapstats.bytes &&
+		ms->valp != &heapstats.slabcached)
+		*ms->valp = 0;
+	heapstats.peak = heapstats.bytes;
+	return 0;
+    }
+    if (!*args) {
+	for (ms = memstattab; ms->name; ms++) {
+	    convbase(buf, *ms->valp, 10);
+	    printf("%s %s\n", ms->name, buf);
+	}
+	return 0;
+    }
+    for (; *args; args++) {
+	for (ms = memstattab; ms->name; ms++)
+	    if (!strcmp(ms->name, *args))
+		break;
+	if (!ms->name) {
+	    zwarnnam(nam, "no such statistic: %s", *args);
+	    ret = 1;
+	    continue;
+	}
+	convbase(buf, *ms->valp, 10);
+	printf("%s\n", buf);
+    }
+    return ret;
+}
+
+static struct builtin bintab[] = {
+    BUILTIN("memstats", 0, bin_memstats, 0, -1, 0, "r", NULL),
+};
+
+static struct features module_features = {
+    bintab, sizeof(bintab)/sizeof(*bintab),
+    NULL, 0,
+    NULL, 0,
+    NULL, 0,
+    0
+};
+
+/**/
+int
+setup_(UNUSED(Module m))
+{
+    return 0;
+}
+
+/**/
+int
+features_(Module m, char ***features)
+{
+    *features = featuresarray(m, &module_features);
+    return 0;
+}
+
+/**/
+int
+enables_(Module m, int **enables)
+{
+    return handlefeatures(m, &module_features, enables);
+}
+
+/**/
+int
+boot_(UNUSED(Module m))
+{
+    return 0;
+}
+
+/**/
+int
+cleanup_(Module m)
+{
+    return setfeatureenables(m, &module_features, NULL);
+}
+
+/**/
+int
+finish_(UNUSED(Module m))
+{
+    return 0;
+}
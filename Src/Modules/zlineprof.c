@@ -0,0 +1,389 @@
+/*
+ * zlineprof.c - a line profiling module for zsh
+ *
+ * This file is part of zsh, the Z shell.
+ *
+ * Copyright (c) 2026 The Zsh Development Group
+ * All rights reserved.
+ *
+ * Permission is hereby granted, without written agreement and without
+ * license or royalty fees, to use, copy, modify, and distribute this
+ * software and to distribute modified versions of this software for any
+ * purpose, provided that the above copyright notice and the following
+ * two paragraphs appear in all copies of this software.
+ *
+ * In no event shall the Zsh Development Group be liable to any party for
+ * direct, indirect, special, incidental, or consequential damages arising
+ * out of the use of this software and its documentation, even if the Zsh
+ * Development Group have been advised of the possibility of such damage.
+ *
+ * The Zsh Development Group specifically disclaim any warranties,
+ * including, but not limited to, the implied warranties of
+ * merchantability and fitness for a particular purpose.  The software
+ * provided hereunder is on an "as is" basis, and the Zsh Development
+ * Group have no obligation to provide maintenance, support, updates,
+ * enhancements, or modifications.
+ *
+ */
+
+#include "zlineprof.mdh"
+#include "zlineprof.pro"
+
+/*
+ * Time and execution counts are recorded for each distinct stack of
+ * shell code.  A stack is kept as a string in the folded format read by
+ * flame graph tools: frames separated by semicolons, outermost first.
+ * Each frame is "name@file:line", naming the function (or "zsh" at the
+ * top level) and the line in it being executed; expansions under way
+ * on the innermost line add frames such as "[glob]".
+ */
+
+typedef struct lpstack *Lpstack;
+
+struct lpstack {
+    struct hashnode node;
+    zlong count;		/* times the innermost line was started */
+    zlong nsec;			/* time spent, in nanoseconds */
+};
+
+/* Deepest nesting of expansions recorded */
+#define LP_MAXEXPAND 16
+
+static HashTable lptab;
+static Module zlineprof_module;
+
+/* Stack of the line running now, without expansions, or NULL */
+static char *lpline;
+/* Expansions under way on that line */
+static char *lpexpand[LP_MAXEXPAND];
+static int lpnexpand;
+/* When time was last charged to a stack */
+static struct timespec lplast;
+
+/* Buffer for building stacks */
+static char *lpbuf;
+static int lpbufsz;
+
+/**/
+static void
+freelpstack(HashNode hn)
+{
+    zsfree(hn->nam);
+    zfree(hn, sizeof(struct lpstack));
+}
+
+static HashTable
+newlptab(void)
+{
+    HashTable ht = newhashtable(127, "zlineprof", NULL);
+
+    ht->hash        = hasher;
+    ht->emptytable  = emptyhashtable;
+    ht->filltable   = NULL;
+    ht->cmpnodes    = strcmp;
+    ht->addnode     = addhashnode;
+    ht->getnode     = gethashnode2;
+    ht->getnode2    = gethashnode2;
+    ht->removenode  = removehashnode;
+    ht->disablenode = NULL;
+    ht->enablenode  = NULL;
+    ht->freenode    = freelpstack;
+    ht->printnode   = NULL;
+
+    return ht;
+}
+
+/* Append a string to lpbuf at offset pos, returning the new end */
+
+static int
+lpadd(int pos, const char *s)
+{
+    int len = strlen(s);
+
+    if (pos + len + 1 > lpbufsz) {
+	lpbufsz = 2 * (pos + len + 1);
+	lpbuf = zrealloc(lpbuf, lpbufsz);
+    }
+    strcpy(lpbuf + pos, s);
+    return pos + len;
+}
+
+/* Append the frame for the code of f (NULL for the top level) */
+
+static int
+lpframe(int pos, Funcstack f, zlong off)
+{
+    char buf[DIGBUFSIZE];
+    char *file;
+
+    if (!f) {
+	pos = lpadd(pos, "zsh@");
+	file = scriptfilename ? scriptfilename : "zsh";
+    } else {
+	pos = lpadd(pos, f->name);
+	pos = lpadd(pos, "@");
+	file = f->filename ? f->filename : "";
+	if (f->tp != FS_SOURCE) {
+	    /* Line numbers in functions and eval are relative */
+	    off += f->flineno;
+	    if (f->tp == FS_EVAL)
+		off--;
+	}
+    }
+    pos = lpadd(pos, file);
+    pos = lpadd(pos, ":");
+    convbase(buf, off, 10);
+    return lpadd(pos, buf);
+}
+
+/* Set lpline from the function stack and the current line number */
+
+static void
+lpsetline(void)
+{
+    Funcstack f, *fs;
+    int depth, i, pos;
+
+    for (f = funcstack, depth = 0; f; f = f->prev)
+	depth++;
+    fs = (Funcstack *) zalloc((depth + 1) * sizeof(Funcstack));
+    fs[0] = NULL;
+    for (f = funcstack, i = depth; f; f = f->prev)
+	fs[i--] = f;
+
+    /*
+     * Each function's entry records the line of the caller it was
+     * called from; the innermost line is the current one.
+     */
+    for (i = pos = 0; i <= depth; i++) {
+	if (i)
+	    pos = lpadd(pos, ";");
+	pos = lpframe(pos, fs[i], i < depth ? fs[i + 1]->lineno : lineno);
+    }
+    zfree(fs, (depth + 1) * sizeof(Funcstack));
+    zsfree(lpline);
+    lpline = ztrdup(lpbuf);
+}
+
+/* Find or create the entry for the stack running now */
+
+static Lpstack
+lpcurrent(void)
+{
+    Lpstack s;
+    int i, pos;
+
+    if (!lpline)
+	return NULL;
+    pos = lpadd(0, lpline);
+    for (i = 0; i < lpnexpand && i < LP_MAXEXPAND; i++) {
+	pos = lpadd(pos, ";[");
+	pos = lpadd(pos, lpexpand[i]);
+	pos = lpadd(pos, "]");
+    }
+    if (!(s = (Lpstack) lptab->getnode(lptab, lpbuf))) {
+	s = (Lpstack) zshcalloc(sizeof(*s));
+	lptab->addnode(lptab, ztrdup(lpbuf), s);
+    }
+    return s;
+}
+
+/* Charge the time since the last call to the stack running now */
+
+static Lpstack
+lpcharge(void)
+{
+    struct timespec now;
+    Lpstack s;
+
+    zgettime_monotonic_if_available(&now);
+    if ((s = lpcurrent()))
+	s->nsec += (zlong) (now.tv_sec - lplast.tv_sec) * 1000000000 +
+	    (now.tv_nsec - lplast.tv_nsec);
+    lplast = now;
+    return s;
+}
+
+static int
+lpactive(void)
+{
+    return zlineprof_module && !(zlineprof_module->node.flags & MOD_UNLOAD);
+}
+
+/**/
+static int
+zlineprof_line(UNUSED(Hookdef dummy), UNUSED(void *dat))
+{
+    Lpstack s;
+
+    if (!lpactive())
+	return 0;
+    lpcharge();
+    lpsetline();
+    if ((s = lpcurrent()))
+	s->count++;
+    return 0;
+}
+
+/**/
+static int
+zlineprof_expand_start(UNUSED(Hookdef dummy), void *dat)
+{
+    Lpstack s;
+
+    if (!lpactive())
+	return 0;
+    lpcharge();
+    if (lpnexpand < LP_MAXEXPAND)
+	lpexpand[lpnexpand] = (char *) dat;
+    lpnexpand++;
+    if ((s = lpcurrent()))
+	s->count++;
+    return 0;
+}
+
+/**/
+static int
+zlineprof_expand_end(UNUSED(Hookdef dummy), UNUSED(void *dat))
+{
+    if (!lpactive() || !lpnexpand)
+	return 0;
+    lpcharge();
+    lpnexpand--;
+    return 0;
+}
+
+/**/
+static int
+zlineprof_wrapper(Eprog prog, FuncWrap w, char *name)
+{
+    char *oline;
+    int onexpand;
+
+    if (!lpactive()) {
+	runshfunc(prog, w, name);
+	return 0;
+    }
+
+    /*
+     * The function's lines are charged to it as they start; when it
+     * returns, the caller's line carries on from where it left off.
+     */
+    lpcharge();
+    oline = lpline;
+    lpline = NULL;
+    onexpand = lpnexpand;
+    lpnexpand = 0;
+    runshfunc(prog, w, name);
+    if (lpactive())
+	lpcharge();
+    zsfree(lpline);
+    lpline = oline;
+    lpnexpand = onexpand;
+    return 0;
+}
+
+/**/
+static void
+printlpstack(HashNode hn, int counts)
+{
+    Lpstack s = (Lpstack) hn;
+    char buf[DIGBUFSIZE];
+
+    convbase(buf, counts ? s->count : s->nsec / 1000, 10);
+    printf("%s %s\n", s->node.nam, buf);
+}
+
+/**/
+static int
+bin_zlineprof(UNUSED(char *nam), UNUSED(char **args), Options ops, UNUSED(int func))
+{
+    if (OPT_ISSET(ops,'c')) {
+	lptab->emptytable(lptab);
+	zgettime_monotonic_if_available(&lplast);
+	return 0;
+    }
+    queue_signals();
+    scanhashtable(lptab, 1, 0, 0, printlpstack, OPT_ISSET(ops,'n'));
+    unqueue_signals();
+    return 0;
+}
+
+static struct builtin bintab[] = {
+    BUILTIN("zlineprof", 0, bin_zlineprof, 0, 0, 0, "cn", NULL),
+};
+
+static struct funcwrap wrapper[] = {
+    WRAPDEF(zlineprof_wrapper),
+};
+
+static struct features module_features = {
+    bintab, sizeof(bintab)/sizeof(*bintab),
+    NULL, 0,
+    NULL, 0,
+    NULL, 0,
+    0
+};
+
+/**/
+int
+setup_(Module m)
+{
+    zlineprof_module = m;
+    return 0;
+}
+
+/**/
+int
+features_(Module m, char ***features)
+{
+    *features = featuresarray(m, &module_features);
+    return 0;
+}
+
+/**/
+int
+enables_(Module m, int **enables)
+{
+    return handlefeatures(m, &module_features, enables);
+}
+
+/**/
+int
+boot_(Module m)
+{
+    lptab = newlptab();
+    lpline = NULL;
+    lpnexpand = 0;
+    zgettime_monotonic_if_available(&lplast);
+    addhookfunc("exec_line", zlineprof_line);
+    addhookfunc("expand_start", zlineprof_expand_start);
+    addhookfunc("expand_end", zlineprof_expand_end);
+    return addwrapper(m, wrapper);
+}
+
+/**/
+int
+cleanup_(Module m)
+{
+    deletehookfunc("exec_line", zlineprof_line);
+    deletehookfunc("expand_start", zlineprof_expand_start);
+    deletehookfunc("expand_end", zlineprof_expand_end);
+    deletewrapper(m, wrapper);
+    deletehashtable(lptab);
+    lptab = NULL;
+    zsfree(lpline);
+    lpline = NULL;
+    zfree(lpbuf, lpbufsz);
+    lpbuf = NULL;
+    lpbufsz = 0;
+    return setfeatureenables(m, &module_features, NULL);
+}
+
+/**/
+int
+finish_(UNUSED(Module m))
+{
+    zlineprof_module = NULL;
+    return 0;
+}
@@ -30,17 +30,15 @@
 #include "zprof.mdh"
 #include "zprof.pro"
 
-#include <sys/time.h>
-#include <unistd.h>
-
 typedef struct pfunc *Pfunc;
 
 struct pfunc {
-    Pfunc next;
+    Pfunc next;			/* next in list of all functions */
+    Pfunc hnext;		/* next in hash chain */
     char *name;
     long calls;
-    double time;
-    double self;
+    zlong time;			/* nanoseconds including called functions */
+    zlong self;			/* nanoseconds in the function itself */
     long num;
 };
 
@@ -49,18 +47,19 @@ typedef struct sfunc *Sfunc;
 struct sfunc {
     Pfunc p;
     Sfunc prev;
-    double beg;
+    zlong beg;
 };
 
 typedef struct parc *Parc;
 
 struct parc {
-    Parc next;
+    Parc next;			/* next in list of all arcs */
+    Parc hnext;			/* next in hash chain */
     Pfunc from;
     Pfunc to;
     long calls;
-    double time;
-    double self;
+    zlong time;
+    zlong self;
 };
 
 static Pfunc calls;
@@ -69,6 +68,23 @@ static Parc arcs;
 static int narcs;
 static Sfunc stack;
 static Module zprof_module;
+/* Whether calls are being recorded; see zprof -d and -e */
+static int enabled;
+
+/*
+ * Functions are hashed by name and arcs by the pair of functions, so
+ * that finding the record for a call does not depend on how many
+ * functions have been seen.  The tables grow to keep chains short.
+ */
+static Pfunc *functab;
+static int functabsize;
+static Parc *arctab;
+static int arctabsize;
+
+#define ZPROF_TABSIZE 64
+
+#define archash(f, t) \
+    ((unsigned) (((size_t) (f) >> 4) * 31 + ((size_t) (t) >> 4)))
 
 static void
 freepfuncs(Pfunc f)
@@ -93,30 +109,154 @@ freeparcs(Parc a)
     }
 }
 
+static void
+hashpfuncs(int size)
+{
+    Pfunc f;
+    unsigned h;
+
+    zfree(functab, functabsize * sizeof(Pfunc));
+    functab = (Pfunc *) zshcalloc(size * sizeof(Pfunc));
+    functabsize = size;
+    for (f = calls; f; f = f->next) {
+	h = hasher(f->name) % functabsize;
+	f->hnext = functab[h];
+	functab[h] = f;
+    }
+}
+
+static void
+hashparcs(int size)
+{
+    Parc a;
+    unsigned h;
+
+    zfree(arctab, arctabsize * sizeof(Parc));
+    arctab = (Parc *) zshcalloc(size * sizeof(Parc));
+    arctabsize = size;
+    for (a = arcs; a; a = a->next) {
+	h = archash(a->from, a->to) % arctabsize;
+	a->hnext = arctab[h];
+	arctab[h] = a;
+    }
+}
+
 static Pfunc
 findpfunc(char *name)
 {
     Pfunc f;
 
-    for (f = calls; f; f = f->next)
+    for (f = functab[hasher(name) % functabsize]; f; f = f->hnext)
 	if (!strcmp(name, f->name))
 	    return f;
 
     return NULL;
 }
 
+static Pfunc
+addpfunc(char *name)
+{
+    Pfunc f = (Pfunc) zalloc(sizeof(*f));
+    unsigned h;
+
+    f->name = ztrdup(name);
+    f->calls = 0;
+    f->time = f->self = 0;
+    f->next = calls;
+    calls = f;
+    if (++ncalls > 2 * functabsize)
+	hashpfuncs(4 * functabsize);
+    else {
+	h = hasher(name) % functabsize;
+	f->hnext = functab[h];
+	functab[h] = f;
+    }
+    return f;
+}
+
 static Parc
 findparc(Pfunc f, Pfunc t)
 {
     Parc a;
 
-    for (a = arcs; a; a = a->next)
+    for (a = arctab[archash(f, t) % arctabsize]; a; a = a->hnext)
 	if (a->from == f && a->to == t)
 	    return a;
 
     return NULL;
 }
 
+static Parc
+addparc(Pfunc f, Pfunc t)
+{
+    Parc a = (Parc) zalloc(sizeof(*a));
+    unsigned h;
+
+    a->from = f;
+    a->to = t;
+    a->calls = 0;
+    a->time = a->self = 0;
+    a->next = arcs;
+    arcs = a;
+    if (++narcs > 2 * arctabsize)
+	hashparcs(4 * arctabsize);
+    else {
+	h = archash(f, t) % arctabsize;
+	a->hnext = arctab[h];
+	arctab[h] = a;
+    }
+    return a;
+}
+
+/*
+ * Discard the results, or zero them if functions being timed use them.
+ * Calls still in progress keep their count, since they were counted
+ * when they started and will add their time when they finish.
+ */
+
+static void
+clearprofile(void)
+{
+    if (stack) {
+	Pfunc f;
+	Parc a;
+	Sfunc sp;
+
+	for (f = calls; f; f = f->next) {
+	    f->calls = 0;
+	    f->time = f->self = 0;
+	}
+	for (a = arcs; a; a = a->next) {
+	    a->calls = 0;
+	    a->time = a->self = 0;
+	}
+	for (sp = stack; sp; sp = sp->prev)
+	    sp->p->calls++;
+	return;
+    }
+    freepfuncs(calls);
+    calls = NULL;
+    ncalls = 0;
+    freeparcs(arcs);
+    arcs = NULL;
+    narcs = 0;
+    hashpfuncs(ZPROF_TABSIZE);
+    hashparcs(ZPROF_TABSIZE);
+}
+
+static zlong
+zprof_now(void)
+{
+    struct timespec ts;
+
+    zgettime_monotonic_if_available(&ts);
+    return (zlong) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Convert nanoseconds to the milliseconds shown in the text listing */
+
+#define MSEC(t) ((double) (t) / 1000000.0)
+
 static int
 cmpsfuncs(Pfunc *a, Pfunc *b)
 {
@@ -135,80 +275,191 @@ cmpparcs(Parc *a, Parc *b)
     return ((*a)->time > (*b)->time ? -1 : ((*a)->time != (*b)->time));
 }
 
+static void
+printtext(Pfunc *fs, int nfs, Parc *as, int nas)
+{
+    Pfunc *fp;
+    Parc *ap;
+    long i;
+    double total;
+
+    for (total = 0.0, fp = fs; *fp; fp++)
+	total += MSEC((*fp)->self);
+
+    qsort(fs, nfs, sizeof(*fs),
+	  (int (*) _((const void *, const void *))) cmpsfuncs);
+    qsort(as, nas, sizeof(*as),
+	  (int (*) _((const void *, const void *))) cmpparcs);
+
+    printf("num  calls                time                       self            name\n-----------------------------------------------------------------------------------\n");
+    for (fp = fs, i = 1; *fp; fp++, i++) {
+	printf("%2ld) %4ld       %8.2f %8.2f  %6.2f%%  %8.2f %8.2f  %6.2f%%  %s\n",
+	       ((*fp)->num = i),
+	       (*fp)->calls,
+	       MSEC((*fp)->time), MSEC((*fp)->time) / ((double) (*fp)->calls),
+	       (MSEC((*fp)->time) / total) * 100.0,
+	       MSEC((*fp)->self), MSEC((*fp)->self) / ((double) (*fp)->calls),
+	       (MSEC((*fp)->self) / total) * 100.0,
+	       (*fp)->name);
+    }
+    qsort(fs, nfs, sizeof(*fs),
+	  (int (*) _((const void *, const void *))) cmptfuncs);
+
+    for (fp = fs; *fp; fp++) {
+	printf("\n-----------------------------------------------------------------------------------\n\n");
+	for (ap = as; *ap; ap++)
+	    if ((*ap)->to == *fp) {
+		printf("    %4ld/%-4ld  %8.2f %8.2f  %6.2f%%  %8.2f %8.2f             %s [%ld]\n",
+		       (*ap)->calls, (*fp)->calls,
+		       MSEC((*ap)->time),
+		       MSEC((*ap)->time) / ((double) (*ap)->calls),
+		       (MSEC((*ap)->time) / total) * 100.0,
+		       MSEC((*ap)->self),
+		       MSEC((*ap)->self) / ((double) (*ap)->calls),
+		       (*ap)->from->name, (*ap)->from->num);
+	    }
+	printf("%2ld) %4ld       %8.2f %8.2f  %6.2f%%  %8.2f %8.2f  %6.2f%%  %s\n",
+	       (*fp)->num, (*fp)->calls,
+	       MSEC((*fp)->time), MSEC((*fp)->time) / ((double) (*fp)->calls),
+	       (MSEC((*fp)->time) / total) * 100.0,
+	       MSEC((*fp)->self), MSEC((*fp)->self) / ((double) (*fp)->calls),
+	       (MSEC((*fp)->self) / total) * 100.0,
+	       (*fp)->name);
+	for (ap = as + nas - 1; ap >= as; ap--)
+	    if ((*ap)->from == *fp) {
+		printf("    %4ld/%-4ld  %8.2f %8.2f  %6.2f%%  %8.2f %8.2f             %s [%ld]\n",
+		       (*ap)->calls, (*ap)->to->calls,
+		       MSEC((*ap)->time),
+		       MSEC((*ap)->time) / ((double) (*ap)->calls),
+		       (MSEC((*ap)->time) / total) * 100.0,
+		       MSEC((*ap)->self),
+		       MSEC((*ap)->self) / ((double) (*ap)->calls),
+		       (*ap)->to->name, (*ap)->to->num);
+	    }
+    }
+}
+
+/* Output a function name as a JSON string */
+
+static void
+printjsonname(char *name)
+{
+    int len;
+    char *s = unmetafy(dupstring(name), &len);
+
+    putchar('"');
+    for (; len--; s++) {
+	if (*s == '"' || *s == '\\')
+	    printf("\\%c", *s);
+	else if ((unsigned char) *s < 0x20)
+	    printf("\\u%04x", (unsigned char) *s);
+	else
+	    putchar(*s);
+    }
+    putchar('"');
+}
+
+static void
+printzlong(zlong v)
+{
+    char buf[DIGBUFSIZE];
+
+    convbase(buf, v, 10);
+    fputs(buf, stdout);
+}
+
+static void
+printjson(Pfunc *fs, Parc *as)
+{
+    Pfunc *fp;
+    Parc *ap;
+
+    printf("{\"functions\":[");
+    for (fp = fs; *fp; fp++) {
+	printf("%s\n{\"name\":", fp == fs ? "" : ",");
+	printjsonname((*fp)->name);
+	printf(",\"calls\":%ld,\"time_ns\":", (*fp)->calls);
+	printzlong((*fp)->time);
+	printf(",\"self_ns\":");
+	printzlong((*fp)->self);
+	putchar('}');
+    }
+    printf("],\n\"arcs\":[");
+    for (ap = as; *ap; ap++) {
+	printf("%s\n{\"caller\":", ap == as ? "" : ",");
+	printjsonname((*ap)->from->name);
+	printf(",\"callee\":");
+	printjsonname((*ap)->to->name);
+	printf(",\"calls\":%ld,\"time_ns\":", (*ap)->calls);
+	printzlong((*ap)->time);
+	printf(",\"self_ns\":");
+	printzlong((*ap)->self);
+	putchar('}');
+    }
+    printf("]}\n");
+}
+
+static void
+printcallgrind(Pfunc *fs, Parc *as)
+{
+    Pfunc *fp;
+    Parc *ap;
+
+    printf("# callgrind format\nversion: 1\ncreator: zsh zprof\n"
+	   "positions: line\nevents: ns\n");
+    for (fp = fs; *fp; fp++) {
+	printf("\nfn=%s\n0 ", unmeta((*fp)->name));
+	printzlong((*fp)->self);
+	putchar('\n');
+	for (ap = as; *ap; ap++)
+	    if ((*ap)->from == *fp) {
+		printf("cfn=%s\ncalls=%ld 0\n0 ",
+		       unmeta((*ap)->to->name), (*ap)->calls);
+		printzlong((*ap)->time);
+		putchar('\n');
+	    }
+    }
+}
+
 static int
-bin_zprof(UNUSED(char *nam), UNUSED(char **args), Options ops, UNUSED(int func))
+bin_zprof(char *nam, UNUSED(char **args), Options ops, UNUSED(int func))
 {
-    if (OPT_ISSET(ops,'c')) {
-	freepfuncs(calls);
-	calls = NULL;
-	ncalls = 0;
-	freeparcs(arcs);
-	arcs = NULL;
-	narcs = 0;
-    } else {
+    char *format = OPT_ISSET(ops,'f') ? OPT_ARG(ops,'f') : NULL;
+
+    if (format && strcmp(format, "text") && strcmp(format, "json") &&
+	strcmp(format, "callgrind")) {
+	zwarnnam(nam, "unknown format: %s", format);
+	return 1;
+    }
+    if (OPT_ISSET(ops,'c'))
+	clearprofile();
+    if (OPT_ISSET(ops,'d'))
+	enabled = 0;
+    if (OPT_ISSET(ops,'e'))
+	enabled = 1;
+    if (format || !(OPT_ISSET(ops,'c') || OPT_ISSET(ops,'d') ||
+		    OPT_ISSET(ops,'e'))) {
 	VARARR(Pfunc, fs, (ncalls + 1));
 	Pfunc f, *fp;
 	VARARR(Parc, as, (narcs + 1));
 	Parc a, *ap;
-	long i;
-	double total;
 
-	for (total = 0.0, f = calls, fp = fs; f; f = f->next, fp++) {
-	    *fp = f;
-	    total += f->self;
-	}
+	/* Entries zeroed by zprof -c while still in use are left out */
+	for (f = calls, fp = fs; f; f = f->next)
+	    if (f->calls)
+		*fp++ = f;
 	*fp = NULL;
-	for (a = arcs, ap = as; a; a = a->next, ap++)
-	    *ap = a;
+	for (a = arcs, ap = as; a; a = a->next)
+	    if (a->calls)
+		*ap++ = a;
 	*ap = NULL;
 
-	qsort(fs, ncalls, sizeof(f),
-	      (int (*) _((const void *, const void *))) cmpsfuncs);
-	qsort(as, narcs, sizeof(a),
-	      (int (*) _((const void *, const void *))) cmpparcs);
-
-	printf("num  calls                time                       self            name\n-----------------------------------------------------------------------------------\n");
-	for (fp = fs, i = 1; *fp; fp++, i++) {
-	    printf("%2ld) %4ld       %8.2f %8.2f  %6.2f%%  %8.2f %8.2f  %6.2f%%  %s\n",
-		   ((*fp)->num = i),
-		   (*fp)->calls,
-		   (*fp)->time, (*fp)->time / ((double) (*fp)->calls),
-		   ((*fp)->time / total) * 100.0,
-		   (*fp)->self, (*fp)->self / ((double) (*fp)->calls),
-		   ((*fp)->self / total) * 100.0,
-		   (*fp)->name);
-	}
-	qsort(fs, ncalls, sizeof(f),
-	      (int (*) _((const void *, const void *))) cmptfuncs);
-
-	for (fp = fs; *fp; fp++) {
-	    printf("\n-----------------------------------------------------------------------------------\n\n");
-	    for (ap = as; *ap; ap++)
-		if ((*ap)->to == *fp) {
-		    printf("    %4ld/%-4ld  %8.2f %8.2f  %6.2f%%  %8.2f %8.2f             %s [%ld]\n",
-			   (*ap)->calls, (*fp)->calls,
-			   (*ap)->time, (*ap)->time / ((double) (*ap)->calls),
-			   ((*ap)->time / total) * 100.0,
-			   (*ap)->self, (*ap)->self / ((double) (*ap)->calls),
-			   (*ap)->from->name, (*ap)->from->num);
-		}
-	    printf("%2ld) %4ld       %8.2f %8.2f  %6.2f%%  %8.2f %8.2f  %6.2f%%  %s\n",
-		   (*fp)->num, (*fp)->calls,
-		   (*fp)->time, (*fp)->time / ((double) (*fp)->calls),
-		   ((*fp)->time / total) * 100.0,
-		   (*fp)->self, (*fp)->self / ((double) (*fp)->calls),
-		   ((*fp)->self / total) * 100.0,
-		   (*fp)->name);
-	    for (ap = as + narcs - 1; ap >= as; ap--)
-		if ((*ap)->from == *fp) {
-		    printf("    %4ld/%-4ld  %8.2f %8.2f  %6.2f%%  %8.2f %8.2f             %s [%ld]\n",
-			   (*ap)->calls, (*ap)->to->calls,
-			   (*ap)->time, (*ap)->time / ((double) (*ap)->calls),
-			   ((*ap)->time / total) * 100.0,
-			   (*ap)->self, (*ap)->self / ((double) (*ap)->calls),
-			   (*ap)->to->name, (*ap)->to->num);
-		}
-	}
+	if (!format || !strcmp(format, "text"))
+	    printtext(fs, fp - fs, as, ap - as);
+	else if (!strcmp(format, "json"))
+	    printjson(fs, as);
+	else
+	    printcallgrind(fs, as);
     }
     return 0;
 }
@@ -239,9 +490,7 @@ zprof_wrapper(Eprog prog, FuncWrap w, char *name)
     struct sfunc sf, *sp;
     Pfunc f = NULL;
     Parc a = NULL;
-    struct timeval tv;
-    struct timezone dummy;
-    double prev = 0, now;
+    zlong prev = 0, now;
     char *name_for_lookups;
 
     if (is_anonymous_function_name(name)) {
@@ -250,47 +499,27 @@ zprof_wrapper(Eprog prog, FuncWrap w, char *name)
         name_for_lookups = name;
     }
 
-    if (zprof_module && !(zprof_module->node.flags & MOD_UNLOAD)) {
+    if (zprof_module && !(zprof_module->node.flags & MOD_UNLOAD) &&
+	enabled) {
         active = 1;
-        if (!(f = findpfunc(name_for_lookups))) {
-            f = (Pfunc) zalloc(sizeof(*f));
-            f->name = ztrdup(name_for_lookups);
-            f->calls = 0;
-            f->time = f->self = 0.0;
-            f->next = calls;
-            calls = f;
-            ncalls++;
-        }
+        if (!(f = findpfunc(name_for_lookups)))
+            f = addpfunc(name_for_lookups);
         if (stack) {
-            if (!(a = findparc(stack->p, f))) {
-                a = (Parc) zalloc(sizeof(*a));
-                a->from = stack->p;
-                a->to = f;
-                a->calls = 0;
-                a->time = a->self = 0.0;
-                a->next = arcs;
-                arcs = a;
-                narcs++;
-            }
+            if (!(a = findparc(stack->p, f)))
+                a = addparc(stack->p, f);
         }
         sf.prev = stack;
         sf.p = f;
         stack = &sf;
 
         f->calls++;
-        tv.tv_sec = tv.tv_usec = 0;
-        gettimeofday(&tv, &dummy);
-        sf.beg = prev = ((((double) tv.tv_sec) * 1000.0) +
-                         (((double) tv.tv_usec) / 1000.0));
+        sf.beg = prev = zprof_now();
     }
     runshfunc(prog, w, name);
     if (active) {
-        if (zprof_module && !(zprof_module->node.flags & MOD_UNLOAD)) {
-            tv.tv_sec = tv.tv_usec = 0;
-            gettimeofday(&tv, &dummy);
-
-            now = ((((double) tv.tv_sec) * 1000.0) +
-                   (((double) tv.tv_usec) / 1000.0));
+        if (zprof_module && !(zprof_module->node.flags & MOD_UNLOAD) &&
+	    enabled) {
+            now = zprof_now();
             f->self += now - sf.beg;
             for (sp = sf.prev; sp && sp->p != f; sp = sp->prev);
             if (!sp)
@@ -313,7 +542,7 @@ zprof_wrapper(Eprog prog, FuncWrap w, char *name)
 }
 
 static struct builtin bintab[] = {
-    BUILTIN("zprof", 0, bin_zprof, 0, 0, 0, "c", NULL),
+    BUILTIN("zprof", 0, bin_zprof, 0, 0, 0, "cdef:", NULL),
 };
 
 static struct funcwrap wrapper[] = {
@@ -360,6 +589,9 @@ boot_(Module m)
     arcs = NULL;
     narcs = 0;
     stack = NULL;
+    enabled = 1;
+    hashpfuncs(ZPROF_TABSIZE);
+    hashparcs(ZPROF_TABSIZE);
     return addwrapper(m, wrapper);
 }
 
@@ -369,6 +601,12 @@ cleanup_(Module m)
 {
     freepfuncs(calls);
     freeparcs(arcs);
+    zfree(functab, functabsize * sizeof(Pfunc));
+    functab = NULL;
+    functabsize = 0;
+    zfree(arctab, arctabsize * sizeof(Parc));
+    arctab = NULL;
+    arctabsize = 0;
     deletewrapper(m, wrapper);
     return setfeatureenables(m, &module_features, NULL);
 }
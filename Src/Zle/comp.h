@@ -336,6 +336,24 @@ struct cadata {
     int dummies;               /* add that many dummy matches */
 };
 
+/* A compadd call remembered for reuse; see compstate[cache] */
+
+typedef struct caddrec *Caddrec;
+
+struct caddrec {
+    Caddrec next;
+    struct cadata dat;		/* arguments, in permanent memory */
+    char **argv;		/* the matches */
+    char *prefix;		/* $PREFIX at the time of the call */
+    char *suffix;		/* $SUFFIX ... */
+    char *iprefix;		/* $IPREFIX ... */
+    char *isuffix;		/* $ISUFFIX ... */
+    char *qiprefix;		/* $QIPREFIX ... */
+    char *qisuffix;		/* $QISUFFIX ... */
+    char *patmatch;		/* compstate[pattern_match] ... */
+    char *exact;		/* compstate[exact] ... */
+};
+
 /* List data. */
 
 typedef struct cldata *Cldata;
@@ -438,9 +456,11 @@ typedef void (*CLPrintFunc)(Cmgroup, Cmatch *, int, int, int, int);
 #define CP_QUOTES      (1 << CPN_QUOTES)
 #define CPN_IGNORED    25
 #define CP_IGNORED     (1 << CPN_IGNORED)
+#define CPN_CACHE      26
+#define CP_CACHE       (1 << CPN_CACHE)
 /* See compkpms */
-#define CP_KEYPARAMS   26
-#define CP_ALLKEYS     ((unsigned int) 0x3ffffff)
+#define CP_KEYPARAMS   27
+#define CP_ALLKEYS     ((unsigned int) 0x7ffffff)
 
 /* Hooks. */
 
@@ -287,6 +287,7 @@ int
 do_completion(UNUSED(Hookdef dummy), Compldat dat)
 {
     int ret = 0, lst = dat->lst, incmd = dat->incmd, osl = showinglist;
+    int mkerr, cancelled;
     char *s = dat->s;
     char *opm;
     LinkNode n;
@@ -339,15 +340,23 @@ do_completion(UNUSED(Hookdef dummy), Compldat dat)
     nmessages = 0;
     hasallmatch = 0;
 
-    /* Make sure we have the completion list and compctl. */
-    if (makecomplist(s, incmd, lst)) {
-	/* Error condition: feeeeeeeeeeeeep(). */
+    /*
+     * Make sure we have the completion list and compctl.  With
+     * COMPLETE_CANCEL_ON_INPUT, typing anything meanwhile interrupts this.
+     */
+    if (isset(COMPLETECANCELONINPUT))
+	inputcancel = noquery(0) + 1;
+    mkerr = makecomplist(s, incmd, lst);
+    cancelled = (inputcancel < 0);
+    inputcancel = 0;
+    if (mkerr) {
+	/* Error condition: feeeeeeeeeeeeep(), unless we were cancelled. */
 	zlemetacs = 0;
 	foredel(zlemetall, CUT_RAW);
 	inststr(origline);
 	zlemetacs = origcs;
 	clearlist = 1;
-	ret = 1;
+	ret = !cancelled;
 	minfo.cur = NULL;
 	if (useline < 0) {
 	    /* unmetafy line before calling ZLE */
@@ -535,6 +544,283 @@ after_complete(UNUSED(Hookdef dummy), int *dat)
     return 0;
 }
 
+/*
+ * The completion cache.  If a completion function sets compstate[cache],
+ * the compadd calls it made are kept together with the context they were
+ * made in.  When completion is next tried in the same context with a
+ * longer $PREFIX, the calls are replayed against the new prefix instead
+ * of calling the function again.
+ *
+ * ccachestate is 0 if there is no cache, 1 while the calls of a function
+ * are being recorded, -1 if a call could not be recorded and 2 once the
+ * cache is complete.
+ */
+
+static int ccachestate;
+static char **ccachekey;	/* describes the context, see compcachekey() */
+static char *ccacheprefix;	/* $PREFIX when the function was called */
+static Caddrec ccache, *ccacheend = &ccache;
+
+/* compstate values the function left behind, and where they live */
+#define CCACHEVARS 8
+static char **const ccachevars[CCACHEVARS] = {
+    &complist, &compinsert, &compexact, &comptoend,
+    &comppatmatch, &comppatinsert, &complastprompt, &comprestore
+};
+static char *ccachevals[CCACHEVARS];
+static zlong ccachelistmax;
+
+/**/
+static void
+freecaddrec(Caddrec r)
+{
+    zsfree(r->dat.ipre);
+    zsfree(r->dat.isuf);
+    zsfree(r->dat.ppre);
+    zsfree(r->dat.psuf);
+    zsfree(r->dat.prpre);
+    zsfree(r->dat.pre);
+    zsfree(r->dat.suf);
+    zsfree(r->dat.group);
+    zsfree(r->dat.rems);
+    zsfree(r->dat.remf);
+    zsfree(r->dat.ign);
+    zsfree(r->dat.exp);
+    zsfree(r->dat.disp);
+    zsfree(r->dat.mesg);
+    freecmatcher(r->dat.match);
+    freearray(r->argv);
+    zsfree(r->prefix);
+    zsfree(r->suffix);
+    zsfree(r->iprefix);
+    zsfree(r->isuffix);
+    zsfree(r->qiprefix);
+    zsfree(r->qisuffix);
+    zsfree(r->patmatch);
+    zsfree(r->exact);
+    zfree(r, sizeof(struct caddrec));
+}
+
+/**/
+void
+freecompcache(void)
+{
+    Caddrec r, n;
+    int i;
+
+    for (r = ccache; r; r = n) {
+	n = r->next;
+	freecaddrec(r);
+    }
+    ccache = NULL;
+    ccacheend = &ccache;
+    if (ccachekey)
+	freearray(ccachekey);
+    ccachekey = NULL;
+    zsfree(ccacheprefix);
+    ccacheprefix = NULL;
+    for (i = 0; i < CCACHEVARS; i++) {
+	zsfree(ccachevals[i]);
+	ccachevals[i] = NULL;
+    }
+    ccachestate = 0;
+}
+
+/*
+ * Describe the context a completion function is called in: everything
+ * in $words, compstate and the special parameters that it can see,
+ * apart from the current word and $PREFIX.
+ */
+
+/**/
+static char **
+compcachekey(char *fn)
+{
+    LinkList l = newlinklist();
+    char buf[DIGBUFSIZE], **p;
+    int i;
+
+    addlinknode(l, fn);
+    sprintf(buf, "%d", arrlen(cfargs));
+    addlinknode(l, dupstring(buf));
+    for (p = cfargs; *p; p++)
+	addlinknode(l, *p);
+    addlinknode(l, pwd);
+    addlinknode(l, compcontext);
+    addlinknode(l, compparameter);
+    addlinknode(l, compredirect);
+    addlinknode(l, compquote);
+    addlinknode(l, compsuffix);
+    addlinknode(l, compiprefix);
+    addlinknode(l, compisuffix);
+    addlinknode(l, compqiprefix);
+    addlinknode(l, compqisuffix);
+    addlinknode(l, compvared);
+    addlinknode(l, complist);
+    addlinknode(l, compinsert);
+    addlinknode(l, compexact);
+    addlinknode(l, comptoend);
+    sprintf(buf, "%d", (int) compcurrent);
+    addlinknode(l, dupstring(buf));
+    for (i = 1, p = compwords; *p; p++, i++)
+	addlinknode(l, (i == compcurrent) ? "" : *p);
+
+    return zlinklist2array(l, 1);
+}
+
+/*
+ * Turn the array named by a compadd option argument into the (...)
+ * form get_user_var() understands, so that it no longer depends on the
+ * parameter.  This fails for elements that form cannot represent.
+ */
+
+/**/
+static char *
+compcachelist(char *nam)
+{
+    char **arr, **p, *s, *ret, *q;
+    int len = 3;
+
+    if (!nam || !(arr = get_user_var(nam)))
+	return NULL;
+    for (p = arr; *p; p++) {
+	if (!**p || **p == '\n') {
+	    ccachestate = -1;
+	    return NULL;
+	}
+	len += 2 * strlen(*p) + 1;
+    }
+    q = ret = (char *) zhalloc(len);
+    *q++ = '(';
+    for (p = arr; *p; p++) {
+	if (p != arr)
+	    *q++ = ' ';
+	for (s = *p; *s; s++) {
+	    if (*s == Meta)
+		*q++ = *s++;
+	    else if (*s == '\\' || *s == ',' || *s == '(' || *s == ')' ||
+		     *s == '\n' || inblank(*s))
+		*q++ = '\\';
+	    *q++ = *s;
+	}
+    }
+    *q++ = ')';
+    *q = '\0';
+
+    return ztrdup(ret);
+}
+
+/* Remember a compadd call made while a completion function runs. */
+
+/**/
+static void
+compcacheadd(Cadata dat, char **argv)
+{
+    Caddrec r;
+
+    /* Calls storing matches in arrays don't add any. */
+    if (dat->apar || dat->opar || dat->dpar)
+	return;
+    /* The function may only have moved the start of $PREFIX elsewhere. */
+    if (!strsfx(compprefix, ccacheprefix)) {
+	ccachestate = -1;
+	return;
+    }
+    r = (Caddrec) zshcalloc(sizeof(struct caddrec));
+    r->dat.ipre = ztrdup(dat->ipre);
+    r->dat.isuf = ztrdup(dat->isuf);
+    r->dat.ppre = ztrdup(dat->ppre);
+    r->dat.psuf = ztrdup(dat->psuf);
+    r->dat.prpre = ztrdup(dat->prpre);
+    r->dat.pre = ztrdup(dat->pre);
+    r->dat.suf = ztrdup(dat->suf);
+    r->dat.group = ztrdup(dat->group);
+    r->dat.rems = ztrdup(dat->rems);
+    r->dat.remf = ztrdup(dat->remf);
+    r->dat.ign = compcachelist(dat->ign);
+    r->dat.flags = dat->flags;
+    r->dat.aflags = dat->aflags & ~(CAF_ARRAYS|CAF_KEYS);
+    r->dat.match = cpcmatcher(dat->match);
+    r->dat.exp = ztrdup(dat->exp);
+    r->dat.disp = compcachelist(dat->disp);
+    r->dat.mesg = ztrdup(dat->mesg);
+    r->dat.dummies = dat->dummies;
+    if (dat->aflags & CAF_ARRAYS) {
+	LinkList l = newlinklist();
+	char **arr;
+
+	for (; *argv; argv++)
+	    if ((arr = get_data_arr(*argv, (dat->aflags & CAF_KEYS))))
+		while (*arr)
+		    addlinknode(l, *arr++);
+	r->argv = zlinklist2array(l, 1);
+    } else
+	r->argv = zarrdup(argv);
+    r->prefix = ztrdup(compprefix);
+    r->suffix = ztrdup(compsuffix);
+    r->iprefix = ztrdup(compiprefix);
+    r->isuffix = ztrdup(compisuffix);
+    r->qiprefix = ztrdup(compqiprefix);
+    r->qisuffix = ztrdup(compqisuffix);
+    r->patmatch = ztrdup(comppatmatch);
+    r->exact = ztrdup(compexact);
+
+    *ccacheend = r;
+    ccacheend = &r->next;
+}
+
+/**/
+static void
+setcompstr(char **var, char *val)
+{
+    zsfree(*var);
+    *var = ztrdup(val);
+}
+
+/* Add the cached matches again for the current, longer, $PREFIX. */
+
+/**/
+static void
+compcachereplay(void)
+{
+    char *ext = dupstring(compprefix + strlen(ccacheprefix));
+    Caddrec r;
+    int i;
+
+    for (r = ccache; r && !errflag; r = r->next) {
+	struct cadata dat = r->dat;
+
+	dat.ipre = dupstring(dat.ipre);
+	dat.isuf = dupstring(dat.isuf);
+	dat.ppre = dupstring(dat.ppre);
+	dat.psuf = dupstring(dat.psuf);
+	dat.prpre = dupstring(dat.prpre);
+	dat.pre = dupstring(dat.pre);
+	dat.suf = dupstring(dat.suf);
+	dat.group = dupstring(dat.group);
+	dat.rems = dupstring(dat.rems);
+	dat.remf = dupstring(dat.remf);
+	dat.ign = dupstring(dat.ign);
+	dat.exp = dupstring(dat.exp);
+	dat.disp = dupstring(dat.disp);
+	dat.mesg = dupstring(dat.mesg);
+
+	setcompstr(&compprefix, dyncat(r->prefix, ext));
+	setcompstr(&compsuffix, r->suffix);
+	setcompstr(&compiprefix, r->iprefix);
+	setcompstr(&compisuffix, r->isuffix);
+	setcompstr(&compqiprefix, r->qiprefix);
+	setcompstr(&compqisuffix, r->qisuffix);
+	setcompstr(&comppatmatch, r->patmatch);
+	setcompstr(&compexact, r->exact);
+
+	addmatches(&dat, arrdup(r->argv));
+    }
+    for (i = 0; i < CCACHEVARS; i++)
+	setcompstr(ccachevars[i], ccachevals[i]);
+    complistmax = ccachelistmax;
+}
+
 /* This calls the given completion widget function. */
 
 static int parwb, parwe, paroffs;
@@ -550,8 +836,8 @@ callcompfunc(char *s, char *fn)
     METACHECK();
 
     if ((shfunc = getshfunc(fn))) {
-	char **p, *tmp;
-	int aadd = 0, usea = 1, icf = incompfunc, osc = sfcontext;
+	char **p, *tmp, **key;
+	int aadd = 0, usea = 1, icf = incompfunc, osc = sfcontext, reuse;
 	unsigned int rset, kset;
 	Param *ocrpms = comprpms, *ockpms = compkpms;
 
@@ -811,6 +1097,23 @@ callcompfunc(char *s, char *fn)
 	    compoldlist = compoldins = "";
 	compoldlist = ztrdup(compoldlist);
 	compoldins = ztrdup(compoldins);
+	zsfree(compcache);
+	compcache = ztrdup("");
+
+	key = compcachekey(fn);
+	reuse = (ccachestate == 2 && arrlen(key) == arrlen(ccachekey) &&
+		 strpfx(ccacheprefix, compprefix) &&
+		 strcmp(ccacheprefix, compprefix));
+	for (p = ccachekey; reuse && *p; p++)
+	    reuse = !strcmp(*p, key[p - ccachekey]);
+	if (reuse)
+	    freearray(key);
+	else {
+	    freecompcache();
+	    ccachekey = key;
+	    ccacheprefix = ztrdup(compprefix);
+	    ccachestate = 1;
+	}
 
 	incompfunc = 1;
 	startparamscope();
@@ -831,9 +1134,14 @@ callcompfunc(char *s, char *fn)
 		while (*p)
 		    addlinknode(largs, dupstring(*p++));
 	    }
-	    opts[XTRACE] = 0;
-	    cfret = doshfunc(shfunc, largs, 1);
-	    opts[XTRACE] = oxt;
+	    if (reuse) {
+		compcachereplay();
+		cfret = 0;
+	    } else {
+		opts[XTRACE] = 0;
+		cfret = doshfunc(shfunc, largs, 1);
+		opts[XTRACE] = oxt;
+	    }
 	} OLDHEAPS;
 	sfcontext = osc;
 	endparamscope();
@@ -925,6 +1233,17 @@ callcompfunc(char *s, char *fn)
 	oldins = (hasoldlist && minfo.cur &&
 		  compoldins && !strcmp(compoldins, "keep"));
 
+	if (ccachestate == 1 && !oldlist && !errflag &&
+	    compcache && *compcache) {
+	    int i;
+
+	    for (i = 0; i < CCACHEVARS; i++)
+		ccachevals[i] = ztrdup(*ccachevars[i]);
+	    ccachelistmax = complistmax;
+	    ccachestate = 2;
+	} else if (!reuse)
+	    freecompcache();
+
 	zfree(comprpms, CP_REALPARAMS * sizeof(Param));
 	zfree(compkpms, CP_KEYPARAMS * sizeof(Param));
 	comprpms = ocrpms;
@@ -2009,6 +2328,7 @@ get_user_var(char *nam)
  * Else, NAME is a plain array; return its elements.
  */
 
+/**/
 static char **
 get_data_arr(char *name, int keys)
 {
@@ -2088,6 +2408,13 @@ addmatches(Cadata dat, char **argv)
     Brinfo bp, bpl = brbeg, obpl, bsl = brend, obsl;
     Heap oldheap;
 
+    if (inputcancel) {
+	checkinputcancel();
+	if (errflag)
+	    return 1;
+    }
+    if (ccachestate == 1)
+	compcacheadd(dat, argv);
     SWITCHHEAPS(oldheap, compheap) {
         if (dat->dummies >= 0)
             dat->aflags = ((dat->aflags | CAF_NOSORT | CAF_UNIQCON) &
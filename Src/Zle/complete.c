@@ -70,7 +70,8 @@ char *compiprefix,
      *comptoend,      /* compstate[to_end]; populates 'movetoend' */
      *compoldlist,
      *compoldins,
-     *compvared;
+     *compvared,
+     *compcache;      /* compstate[cache] */
 
 /*
  * An array of Param structures for compsys special parameters;
@@ -1288,6 +1289,7 @@ static struct compparam compkparams[] = {
     { "list_lines", PM_INTEGER | PM_READONLY, NULL, GSU(listlines_gsu) },
     { "all_quotes", PM_SCALAR | PM_READONLY, NULL, GSU(compqstack_gsu) },
     { "ignored", PM_INTEGER | PM_READONLY, VAL(compignored), NULL },
+    { "cache", PM_SCALAR, VAL(compcache), NULL },
     { NULL, 0, NULL, NULL }
 };
 
@@ -1728,7 +1730,7 @@ setup_(UNUSED(Module m))
 	compquoting = comprestore = complist = compinsert =
 	compexact = compexactstr = comppatmatch = comppatinsert =
 	complastprompt = comptoend = compoldlist = compoldins =
-	compvared = compqstack = NULL;
+	compvared = compqstack = compcache = NULL;
     complastprefix = ztrdup("");
     complastsuffix = ztrdup("");
     complistmax = 0;
@@ -1816,6 +1818,8 @@ finish_(UNUSED(Module m))
     zsfree(compoldlist);
     zsfree(compoldins);
     zsfree(compvared);
+    zsfree(compcache);
+    freecompcache();
 
     hascompmod = 0;
 
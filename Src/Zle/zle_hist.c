@@ -1192,6 +1192,12 @@ doisearch(char **args, int dir, int pattern)
      * Flag that the search was aborted.
      */
     int aborted = 0;
+    /*
+     * Trigram signature of the search string, if it is to be used
+     * to skip history lines that can't match.
+     */
+    unsigned int trigrams[HIST_TRIGRAM_WORDS];
+    int usetrigrams;
 
     if (!(he = quietgethist(hl)))
 	return 1;
@@ -1232,6 +1238,11 @@ doisearch(char **args, int dir, int pattern)
 	    last_line = zt;
 
 	    sbuf[sbptr] = '\0';
+	    /* Only literal patterns have a signature */
+	    usetrigrams = !pattern || !strpbrk(sbuf + (sbuf[0] == '^'),
+					       "\\*?[]<>()|#~^$={}'\"`");
+	    if (usetrigrams)
+		histtrigrams(sbuf + (sbuf[0] == '^'), trigrams, 0);
 	    if (pattern && !patprog && !nosearch) {
 		/* avoid too much heap use, can get heavy round here... */
 		char *patbuf = ztrdup(sbuf);
@@ -1431,6 +1442,10 @@ doisearch(char **args, int dir, int pattern)
 		}
 		hl = he->histnum;
 		zt = GETZLETEXT(he);
+		if (usetrigrams && !histmaycontain(he, trigrams)) {
+		    skip_line = 1;
+		    continue;
+		}
 		pos = (dir == 1) ? 0 : strlen(zt);
 		if (dup_ok)
 		    skip_line = 0;
@@ -1978,6 +1993,7 @@ virepeatsearch(UNUSED(char **args))
     Histent he;
     int n = zmult;
     char *zt;
+    unsigned int trigrams[HIST_TRIGRAM_WORDS];
 
     if (!visrchstr)
 	return 1;
@@ -1987,9 +2003,11 @@ virepeatsearch(UNUSED(char **args))
     }
     if (!(he = quietgethist(histline)))
 	return 1;
+    histtrigrams(visrchstr + (*visrchstr == '^'), trigrams, 0);
     metafy_line();
     while ((he = movehistent(he, visrchsense, hist_skip_flags))) {
-	if (isset(HISTFINDNODUPS) && he->node.flags & HIST_DUP)
+	if ((isset(HISTFINDNODUPS) && he->node.flags & HIST_DUP) ||
+	    !histmaycontain(he, trigrams))
 	    continue;
 	zt = GETZLETEXT(he);
 	if (zlinecmp(zt, zlemetaline) &&
@@ -2028,7 +2046,8 @@ historybeginningsearchbackward(char **args)
     Histent he;
     int cpos = zlecs;		/* save cursor position */
     int n = zmult;
-    char *zt;
+    char *zt, sav;
+    unsigned int trigrams[HIST_TRIGRAM_WORDS];
 
     if (zmult < 0) {
 	int ret;
@@ -2040,10 +2059,14 @@ historybeginningsearchbackward(char **args)
     if (!(he = quietgethist(histline)))
 	return 1;
     metafy_line();
+    sav = zlemetaline[zlemetacs];
+    zlemetaline[zlemetacs] = '\0';
+    histtrigrams(zlemetaline, trigrams, 0);
+    zlemetaline[zlemetacs] = sav;
     while ((he = movehistent(he, -1, hist_skip_flags))) {
 	int tst;
-	char sav;
-	if (isset(HISTFINDNODUPS) && he->node.flags & HIST_DUP)
+	if ((isset(HISTFINDNODUPS) && he->node.flags & HIST_DUP) ||
+	    !histmaycontain(he, trigrams))
 	    continue;
 	zt = GETZLETEXT(he);
 	sav = zlemetaline[zlemetacs];
@@ -2074,7 +2097,8 @@ historybeginningsearchforward(char **args)
     Histent he;
     int cpos = zlecs;		/* save cursor position */
     int n = zmult;
-    char *zt;
+    char *zt, sav;
+    unsigned int trigrams[HIST_TRIGRAM_WORDS];
 
     if (zmult < 0) {
 	int ret;
@@ -2086,10 +2110,14 @@ historybeginningsearchforward(char **args)
     if (!(he = quietgethist(histline)))
 	return 1;
     metafy_line();
+    sav = zlemetaline[zlemetacs];
+    zlemetaline[zlemetacs] = '\0';
+    histtrigrams(zlemetaline, trigrams, 0);
+    zlemetaline[zlemetacs] = sav;
     while ((he = movehistent(he, 1, hist_skip_flags))) {
-	char sav;
 	int tst;
-	if (isset(HISTFINDNODUPS) && he->node.flags & HIST_DUP)
+	if ((isset(HISTFINDNODUPS) && he->node.flags & HIST_DUP) ||
+	    !histmaycontain(he, trigrams))
 	    continue;
 	zt = GETZLETEXT(he);
 	sav = zlemetaline[zlemetacs];
@@ -95,6 +95,8 @@ static const struct gsu_integer pending_gsu =
 { get_pending, NULL, zleunsetfn };
 static const struct gsu_integer recursive_gsu =
 { get_recursive, NULL, zleunsetfn };
+static const struct gsu_integer refresh_bytes_gsu =
+{ get_refresh_bytes, NULL, zleunsetfn };
 static const struct gsu_integer region_active_gsu =
 { get_region_active, set_region_active, zleunsetfn };
 static const struct gsu_integer undo_change_no_gsu =
@@ -165,6 +167,8 @@ static struct zleparam {
     { "PREBUFFER",  PM_SCALAR | PM_READONLY,  GSU(prebuffer_gsu), NULL },
     { "PREDISPLAY", PM_SCALAR, GSU(predisplay_gsu), NULL },
     { "RBUFFER", PM_SCALAR,  GSU(rbuffer_gsu), NULL },
+    { "REFRESH_BYTES", PM_INTEGER | PM_READONLY, GSU(refresh_bytes_gsu),
+      NULL },
     { "REGION_ACTIVE", PM_INTEGER, GSU(region_active_gsu), NULL},
     { "region_highlight", PM_ARRAY, GSU(region_highlight_gsu), NULL },
     { "UNDO_CHANGE_NO", PM_INTEGER | PM_READONLY, GSU(undo_change_no_gsu),
@@ -536,6 +540,13 @@ get_recursive(UNUSED(Param pm))
     return zle_recursive;
 }
 
+/**/
+static zlong
+get_refresh_bytes(UNUSED(Param pm))
+{
+    return refreshbytes;
+}
+
 /**/
 static zlong
 get_yankstart(UNUSED(Param pm))
@@ -245,6 +245,11 @@ int region_active;
 /**/
 char *tcout_func_name;
 
+/* bytes written to the terminal by the last redisplay */
+
+/**/
+zlong refreshbytes;
+
 #ifdef HAVE_SELECT
 /* cost of last update */
 /**/
@@ -631,19 +636,39 @@ zwcputc(const REFRESH_ELEMENT *c)
 
 	memset(&mbstate, 0, sizeof(mbstate_t));
 	while (nchars--) {
-	    if ((i = wcrtomb(mbtmp, (wchar_t)*wcptr++, &mbstate)) > 0)
+	    if ((i = wcrtomb(mbtmp, (wchar_t)*wcptr++, &mbstate)) > 0) {
 		fwrite(mbtmp, i, 1, shout);
+		shoutbytes += i;
+	    }
 	}
     } else if (c->chr != WEOF) {
 	memset(&mbstate, 0, sizeof(mbstate_t));
-	if ((i = wcrtomb(mbtmp, (wchar_t)c->chr, &mbstate)) > 0)
+	if ((i = wcrtomb(mbtmp, (wchar_t)c->chr, &mbstate)) > 0) {
 	    fwrite(mbtmp, i, 1, shout);
+	    shoutbytes += i;
+	}
     }
 #else
-    fputc(c->chr, shout);
+    putshout(c->chr);
 #endif
 }
 
+/*
+ * Output a prompt string as zputs() would, counting the bytes.
+ */
+
+static void
+zrputs(char const *s)
+{
+    while (*s) {
+	if (*s == Meta)
+	    putshout(*++s ^ 32);
+	else if (!itok(*s))
+	    putshout(*s);
+	s++;
+    }
+}
+
 static int
 zwcwrite(const REFRESH_STRING s, size_t i)
 {
@@ -962,6 +987,110 @@ bufswap(void)
 #endif
 }
 
+/*
+ * The region highlights that can affect the display, in the order
+ * they are applied, and the sorted positions at which they start and
+ * end.  Set up by initregionattrs() for regionattrs().
+ */
+static struct region_highlight **rhapply;
+static int nrhapply;
+static int *rhbounds, nrhbounds, rhnext;
+
+static int
+rhlayercmp(const void *a, const void *b)
+{
+    const struct region_highlight *ra = *(struct region_highlight **)a;
+    const struct region_highlight *rb = *(struct region_highlight **)b;
+
+    if (ra->layer != rb->layer)
+	return ra->layer < rb->layer ? -1 : 1;
+    return ra < rb ? -1 : ra > rb;
+}
+
+static int
+rhboundcmp(const void *a, const void *b)
+{
+    int ia = *(const int *)a, ib = *(const int *)b;
+
+    return ia < ib ? -1 : ia > ib;
+}
+
+static void
+initregionattrs(void)
+{
+    struct region_highlight *rhp;
+    unsigned ireg;
+
+    rhapply = (struct region_highlight **)
+	zhalloc(n_region_highlights * sizeof(*rhapply));
+    rhbounds = (int *)zhalloc(2 * n_region_highlights * sizeof(int));
+    nrhapply = nrhbounds = rhnext = 0;
+    for (ireg = 0, rhp = region_highlights;
+	 ireg < n_region_highlights;
+	 ireg++, rhp++) {
+	int offset;
+	/*
+	 * Layers are applied from 0 up to and including the layer
+	 * for special characters; any others are ignored.
+	 */
+	if (special_layer < 0 ? rhp->layer != 0 :
+	    rhp->layer < 0 || rhp->layer > special_layer)
+	    continue;
+	if (rhp->start >= rhp->end)
+	    continue;
+	if (rhp->flags & ZRH_PREDISPLAY)
+	    offset = 0;	/* include predisplay in start end */
+	else
+	    offset = predisplaylen; /* increment over it */
+	rhapply[nrhapply++] = rhp;
+	rhbounds[nrhbounds++] = rhp->start + offset;
+	rhbounds[nrhbounds++] = rhp->end + offset;
+    }
+    qsort(rhapply, nrhapply, sizeof(*rhapply), rhlayercmp);
+    qsort(rhbounds, nrhbounds, sizeof(*rhbounds), rhboundcmp);
+}
+
+/*
+ * Calculate the attributes at position pos of the line being displayed
+ * from the region highlights:  *base_attrp for ordinary characters,
+ * *all_attrp for those shown specially.  Return the next position
+ * before end at which either may change, so that the caller needn't
+ * look at the highlights again until then.  pos must not decrease
+ * between calls after initregionattrs().
+ */
+static int
+regionattrs(int pos, int end, zattr *base_attrp, zattr *all_attrp)
+{
+    zattr base_attr = mixattrs(default_attr, prompt_attr);
+    zattr all_attr = 0;
+    int i;
+
+    while (rhnext < nrhbounds && rhbounds[rhnext] <= pos)
+	rhnext++;
+    if (rhnext < nrhbounds && rhbounds[rhnext] < end)
+	end = rhbounds[rhnext];
+
+    for (i = 0; i < nrhapply; i++) {
+	struct region_highlight *rhp = rhapply[i];
+	int offset;
+	if (rhp->flags & ZRH_PREDISPLAY)
+	    offset = 0;
+	else
+	    offset = predisplaylen;
+	if (rhp->start + offset <= pos && pos < rhp->end + offset) {
+	    base_attr = mixattrs(rhp->atr, base_attr);
+	    if (special_layer < 0)
+		all_attr = mixattrs(rhp->atr, all_attr);
+	}
+    }
+    if (special_layer >= 0)
+	all_attr = mixattrs(special_attr, base_attr);
+
+    *base_attrp = base_attr;
+    *all_attrp = all_attr;
+    return end;
+}
+
 
 /**/
 mod_export void
@@ -976,9 +1105,14 @@ zrefresh(void)
 	u;			/* pointer for status line stuff	     */
     int tmpcs, tmpll;		/* ditto cursor position and line length     */
     int tmppos;			/* t - tmpline				     */
+    int attrend;		/* tmppos where attributes next change	     */
+    zattr base_attr = 0,	/* attributes from region highlights	     */
+	all_attr = 0;		/* (set before use as attrend starts at 0)  */
     int tmpalloced;		/* flag to free tmpline when finished	     */
     int remetafy;		/* flag that zle line is metafied	     */
     int rprompt_off = 1;	/* Offset of rprompt from right of screen    */
+    zlong startbytes;		/* shoutbytes before anything is output      */
+    char **sync;		/* $zle_synchronized_output		     */
     struct rparams rpms;
 #ifdef MULTIBYTE_SUPPORT
     int width;			/* width of wide character		     */
@@ -992,6 +1126,14 @@ zrefresh(void)
     if (inlist)
 	return;
 
+    /*
+     * Everything up to the fflush() at the end is one frame; if the
+     * terminal supports it, ask it not to show a partial update.
+     */
+    startbytes = shoutbytes;
+    if ((sync = getaparam("zle_synchronized_output")) && arrlen(sync) == 2)
+	zrputs(*sync);
+
     /*
      * zrefresh() is called from all over the place, so we can't
      * be sure if the line is metafied for completion or not.
@@ -1147,9 +1289,9 @@ zrefresh(void)
 	if (termflags & TERM_SHORT)
 	    vcs = 0;
 	else if (!clearflag && lpromptbuf[0]) {
-	    zputs(lpromptbuf, shout);
+	    zrputs(lpromptbuf);
 	    if (lpromptwof == winw)
-		zputs("\n", shout);	/* works with both hasam and !hasam */
+		putshout('\n');	/* works with both hasam and !hasam */
 	    /* lpromptbuf includes literal escapes so we need to update for it */
 	    txtcurrentattrs = txtpendingattrs = pmpt_attr;
 	}
@@ -1158,7 +1300,6 @@ zrefresh(void)
 	    vcs = 0;
 	    moveto(0, lpromptw);
 	}
-	fflush(shout);
 	clearf = clearflag;
     } else if (winw != zterm_columns || rwinh != zterm_lines)
 	resetvideo();
@@ -1193,41 +1334,13 @@ zrefresh(void)
 
     rpms.s = nbuf[rpms.ln = 0] + lpromptw;
     rpms.sen = *nbuf + winw;
-    for (t = tmpline, tmppos = 0; tmppos < tmpll; t++, tmppos++) {
-	zattr base_attr = mixattrs(default_attr, prompt_attr);
-	zattr all_attr;
-	struct region_highlight *rhp;
-	int layer, nextlayer = 0;
+    initregionattrs();
+    for (t = tmpline, tmppos = attrend = 0; tmppos < tmpll; t++, tmppos++) {
 	/*
 	 * Calculate attribute based on region.
 	 */
-	do {
-	    unsigned ireg;
-	    layer = nextlayer;
-	    nextlayer = special_layer;
-	    for (ireg = 0, rhp = region_highlights;
-		ireg < n_region_highlights;
-		ireg++, rhp++) {
-		if (rhp->layer == layer) {
-		    int offset;
-		    if (rhp->flags & ZRH_PREDISPLAY)
-			offset = 0;	/* include predisplay in start end */
-		    else
-			offset = predisplaylen; /* increment over it */
-		    if (rhp->start + offset <= tmppos &&
-			tmppos < rhp->end + offset) {
-			base_attr = mixattrs(rhp->atr, base_attr);
-			if (layer > special_layer)
-			    all_attr = mixattrs(rhp->atr, all_attr);
-		    }
-		} else if (rhp->layer > layer && rhp->layer < nextlayer) {
-		    nextlayer = rhp->layer;
-		}
-	    }
-	    if (special_layer == layer) {
-		all_attr = mixattrs(special_attr, base_attr);
-	    }
-	} while (nextlayer > layer);
+	if (tmppos >= attrend)
+	    attrend = regionattrs(tmppos, tmpll, &base_attr, &all_attr);
 
 	if (t == scs)			/* if cursor is here, remember it */
 	    rpms.nvcs = rpms.s - nbuf[rpms.nvln = rpms.ln];
@@ -1641,7 +1754,7 @@ zrefresh(void)
 	    moveto(0, winw - rprompt_off - rpromptw);
 	    treplaceattrs(pmpt_attr);
 	    applytextattributes(0);
-	    zputs(rpromptbuf, shout);
+	    zrputs(rpromptbuf);
 	    if (rprompt_off) {
 		vcs = winw - rprompt_off;
 	    } else {
@@ -1677,6 +1790,9 @@ individually */
     if (nlnct > vmaxln)
 	vmaxln = nlnct;
 singlelineout:
+    if ((sync = getaparam("zle_synchronized_output")) && arrlen(sync) == 2)
+	zrputs(sync[1]);
+    refreshbytes = shoutbytes - startbytes;
     fflush(shout);		/* make sure everything is written out */
 
     if (tmpalloced)
@@ -2204,9 +2320,10 @@ tc_rightcurs(int ct)
    */
     if (vln == 0 && i < lpromptw && !(termflags & TERM_SHORT)) {
 #ifndef MULTIBYTE_SUPPORT
-	if ((int)strlen(lpromptbuf) == lpromptw)
+	if ((int)strlen(lpromptbuf) == lpromptw) {
 	    fputs(lpromptbuf + i, shout);
-	else 
+	    shoutbytes += lpromptw - i;
+	} else
 #endif
 	if (tccan(TCRIGHT) && (tclen[TCRIGHT] * ct <= ztrlen(lpromptbuf)))
 	    /* it is cheaper to send TCRIGHT than reprint the whole prompt */
@@ -2216,9 +2333,9 @@ tc_rightcurs(int ct)
 	    if (i != 0)
 		zputc(&zr_cr);
 	    tc_upcurs(lprompth - 1);
-	    zputs(lpromptbuf, shout);
+	    zrputs(lpromptbuf);
 	    if (lpromptwof == winw)
-		zputs("\n", shout);	/* works with both hasam and !hasam */
+		putshout('\n');	/* works with both hasam and !hasam */
 	}
 	i = lpromptw;
 	ct = cl - i;
@@ -2594,14 +2711,14 @@ singlerefresh(ZLE_STRING_T tmpline, int tmpll, int tmpcs)
 		    while (mblen) {
 #ifdef MULTIBYTE_SUPPORT
 			if (cc == WEOF)
-			    fputc('?', shout);
+			    putshout('?');
 			else
 #endif
 			    if (*pptr == Meta) {
 				mblen--;
-				fputc(*++pptr ^ 32, shout);
+				putshout(*++pptr ^ 32);
 			    } else {
-				fputc(*pptr, shout);
+				putshout(*pptr);
 			    }
 			pptr++;
 			mblen--;
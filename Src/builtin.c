@@ -2265,6 +2265,7 @@ typeset_single(char *cname, char *pname, Param pm, int func,
 	    if (PM_TYPE(pm->node.flags) == PM_ARRAY) {
 		x = (*pm->gsu.a->getfn)(pm);
 		uniqarray(x);
+		pm->asize = 0;
 		if (pm->node.flags & PM_SPECIAL) {
 		    if (zheapptr(x))
 			x = zarrdup(x);
@@ -5080,6 +5081,7 @@ bin_print(char *name, char **args, Options ops, int func)
 	    ent->node.nam = zjoin(args, ' ', 0);
 	    ent->stim = ent->ftim = time(NULL);
 	    ent->node.flags = 0;
+	    histsettrigrams(ent);
 	    addhistnode(histtab, ent->node.nam, ent);
 	    unqueue_signals();
 	    return 0;
@@ -5562,6 +5564,7 @@ bin_print(char *name, char **args, Options ops, int func)
 		    ent->node.nam = stringval;
 		    ent->stim = ent->ftim = time(NULL);
 		    ent->node.flags = 0;
+		    histsettrigrams(ent);
 		    ent->words = (short *)NULL;
 		    addhistnode(histtab, ent->node.nam, ent);
 		}
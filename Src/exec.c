@@ -1033,7 +1033,7 @@ hashcmd(char *arg0, char **pp)
     if (!*pp)
 	return NULL;
 
-    cn = (Cmdnam) zshcalloc(sizeof *cn);
+    cn = (Cmdnam) slabcalloc(sizeof *cn);
     cn->node.flags = 0;
     cn->u.name = pp;
     cmdnamtab->addnode(cmdnamtab, ztrdup(arg0), cn);
@@ -1395,6 +1395,12 @@ execlist(Estate state, int dont_change_job, int exiting)
 	int this_donetrap = 0;
 	this_noerrexit = 0;
 
+	if (inputcancel) {
+	    checkinputcancel();
+	    if (errflag)
+		break;
+	}
+
 	ltype = WC_LIST_TYPE(code);
 	csp = cmdsp;
 
@@ -1422,6 +1428,7 @@ execlist(Estate state, int dont_change_job, int exiting)
 	    if (lnp1)
 		lineno = lnp1 - 1;
 	}
+	runhookdef(EXECLINEHOOK, NULL);
 
 	if (sigtrapped[SIGDEBUG] && isset(DEBUGBEFORECMD) && !intrap) {
 	    Wordcode pc2 = state->pc;
@@ -2795,6 +2802,258 @@ static void execcmd_getargs(LinkList preargs, LinkList args, int expand)
     }
 }
 
+/**/
+#ifdef USE_POSIX_SPAWN
+
+/*
+ * The environment for commands started by execcmd_spawn(): environ
+ * without $_, with room at the end for $_ and the terminating NULL.
+ * It is only copied again when environgen says environ has changed.
+ */
+
+static char **spawnenv;
+static int spawnenvlen, spawnenvsize, spawnenvgen = -1;
+
+/* Return 0 if two NAME=VALUE strings have the same name. */
+
+/**/
+static int
+envnamecmp(char *a, char *b)
+{
+    for (; *a == *b; a++, b++)
+	if (*a == '=' || !*a)
+	    return 0;
+    return 1;
+}
+
+/*
+ * Return the environment for a spawned command, with the strings
+ * in vars added or replacing those of the same name and with under
+ * as $_.  The array must be used before the next call.
+ */
+
+/**/
+static char **
+getspawnenv(LinkList vars, char *under)
+{
+    char **ep, **pp, **envp;
+    LinkNode node;
+
+    if (spawnenvgen != environgen) {
+	if (spawnenv)
+	    zfree(spawnenv, spawnenvsize * sizeof(char *));
+	for (pp = environ; *pp; pp++)
+	    ;
+	spawnenvsize = (pp - environ) + 2;
+	spawnenv = ep = (char **) zalloc(spawnenvsize * sizeof(char *));
+	for (pp = environ; *pp; pp++)
+	    if ((*pp)[0] != '_' || (*pp)[1] != '=')
+		*ep++ = *pp;
+	spawnenvlen = ep - spawnenv;
+	spawnenvgen = environgen;
+    }
+    if (!vars || empty(vars)) {
+	spawnenv[spawnenvlen] = under;
+	spawnenv[spawnenvlen + 1] = NULL;
+	return spawnenv;
+    }
+    envp = ep = (char **) zhalloc((spawnenvlen + countlinknodes(vars) + 2) *
+				  sizeof(char *));
+    for (pp = spawnenv; pp < spawnenv + spawnenvlen; pp++) {
+	for (node = firstnode(vars); node; incnode(node))
+	    if (!envnamecmp(*pp, (char *) getdata(node)))
+		break;
+	if (!node)
+	    *ep++ = *pp;
+    }
+    for (node = firstnode(vars); node; incnode(node))
+	*ep++ = (char *) getdata(node);
+    *ep++ = under;
+    *ep = NULL;
+    return envp;
+}
+
+/*
+ * Turn the assignments before a command into environment strings for
+ * getspawnenv().  Returns NULL if any of them needs the treatment
+ * addvars() would give it in a forked child:  that is anything but a
+ * plain string, needing no expansion, for a parameter that is either
+ * new or an ordinary scalar.
+ */
+
+/**/
+static LinkList
+spawnvars(Estate state, Wordcode varspc)
+{
+    LinkList vars = newlinklist();
+    LinkNode node;
+    Wordcode opc = state->pc;
+    wordcode ac;
+    Param pm;
+    char *name, *val, *str;
+    int htok = 0;
+
+    state->pc = varspc;
+    while (wc_code(ac = *state->pc++) == WC_ASSIGN) {
+	name = ecgetstr(state, EC_NODUP, &htok);
+	if (htok || WC_ASSIGN_TYPE(ac) != WC_ASSIGN_SCALAR ||
+	    WC_ASSIGN_TYPE2(ac) == WC_ASSIGN_INC)
+	    break;
+	val = ecgetstr(state, EC_NODUP, &htok);
+	if (htok || !strcmp(name, "STTY") || !strcmp(name, "ARGV0") ||
+	    ((pm = (Param) gethashnode2(paramtab, name)) &&
+	     (pm->node.flags & ~(PM_EXPORTED|PM_UNSET)) != PM_SCALAR))
+	    break;
+	str = zhtricat(name, "=", unmeta(val));
+	for (node = firstnode(vars); node; incnode(node))
+	    if (!envnamecmp(str, (char *) getdata(node))) {
+		setdata(node, str);
+		break;
+	    }
+	if (!node)
+	    addlinknode(vars, str);
+    }
+    state->pc = opc;
+    return wc_code(ac) == WC_ASSIGN ? NULL : vars;
+}
+
+/*
+ * Start a simple external command with posix_spawn() rather than
+ * forking, so the cost of starting it doesn't grow with the size of
+ * the shell.  This is only possible when the child would have nothing
+ * to do but exec the command:  no redirections, globbing, pipes, job
+ * control or limits to apply, no assignments other than simple strings
+ * to export, and a command path we can work out here.  Returns the pid
+ * of the new process, or 0 if the command needs to be forked as usual.
+ * That includes the case where the spawn fails, so that the forked
+ * child can retry the exec with the usual path search, #! handling and
+ * error messages.
+ */
+
+/**/
+static pid_t
+execcmd_spawn(Estate state, Wordcode varspc, LinkList args, HashNode hn,
+	      char *text, int oautocont)
+{
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    sigset_t sigdef, mask;
+    struct timeval bgtime;
+    struct timezone dummy_tz;
+    Cmdnam cn;
+    LinkNode node;
+    char *arg0 = (char *) peekfirst(args), *pth, *under;
+    char **argv, **envp, **pp;
+    LinkList vars = NULL;
+    int i, ret;
+    pid_t pid;
+
+    if (isset(RESTRICTED) || STTYval || zgetenv("ARGV0") ||
+	(thisjob != -1 && thisjob >= jobtabsize - 1) ||
+	(varspc && !(vars = spawnvars(state, varspc))))
+	return 0;
+#ifdef HAVE_GETRLIMIT
+    for (i = 0; i < RLIM_NLIMITS; i++)
+	if (limits[i].rlim_max != current_limits[i].rlim_max ||
+	    limits[i].rlim_cur != current_limits[i].rlim_cur)
+	    return 0;
+#endif
+
+    /* Work out the path as execute() would try it first. */
+    if (strchr(arg0, '/'))
+	pth = dupstring(arg0);
+    else if (hn && hn == cmdnamtab->getnode(cmdnamtab, arg0)) {
+	cn = (Cmdnam) hn;
+	if (cn->node.flags & HASHED)
+	    pth = dupstring(cn->u.cmd);
+	else {
+	    if (!cn->u.name)
+		return 0;
+	    for (pp = path; pp < cn->u.name; pp++)
+		if (**pp != '/')
+		    return 0;
+	    pth = zhtricat(*cn->u.name, "/", cn->node.nam);
+	}
+    } else
+	return 0;
+    unmetafy(pth, NULL);
+
+    argv = (char **) zhalloc((countlinknodes(args) + 1) * sizeof(char *));
+    for (node = firstnode(args), i = 0; node; incnode(node))
+	argv[i++] = unmetafy(dupstring((char *) getdata(node)), NULL);
+    argv[i] = NULL;
+
+    /* Pass $_ as zexecve() does, without changing our own environment. */
+    if (*pth == '/')
+	under = dyncat("_=", pth);
+    else
+	under = zhtricat("_=", unmeta(pwd), dyncat("/", pth));
+    envp = getspawnenv(vars, under);
+
+    /*
+     * Close the descriptors that entersubsh() and execute() would
+     * close in a forked child.
+     */
+    posix_spawn_file_actions_init(&fa);
+    for (i = 10; i <= max_zsh_fd; i++)
+	if ((fdtable[i] & FDT_SAVED_MASK) ||
+	    (fdtable[i] & FDT_TYPE_MASK) == FDT_INTERNAL ||
+	    (fdtable[i] & FDT_TYPE_MASK) == FDT_XTRACE)
+	    posix_spawn_file_actions_addclose(&fa, i);
+    /* The coprocess descriptors aren't marked in fdtable. */
+    if (coprocin != -1)
+	posix_spawn_file_actions_addclose(&fa, coprocin);
+    if (coprocout != -1)
+	posix_spawn_file_actions_addclose(&fa, coprocout);
+
+    /* Signal dispositions and mask as set up by entersubsh(). */
+    sigemptyset(&sigdef);
+    sigaddset(&sigdef, SIGTTOU);
+    sigaddset(&sigdef, SIGTTIN);
+    sigaddset(&sigdef, SIGTSTP);
+    if (interact) {
+	sigaddset(&sigdef, SIGTERM);
+	if (!(sigtrapped[SIGINT] & ZSIG_IGNORED))
+	    sigaddset(&sigdef, SIGINT);
+	if (!sigtrapped[SIGPIPE])
+	    sigaddset(&sigdef, SIGPIPE);
+    }
+    if (!(sigtrapped[SIGQUIT] & ZSIG_IGNORED))
+	sigaddset(&sigdef, SIGQUIT);
+    sigprocmask(SIG_SETMASK, NULL, &mask);
+    sigdelset(&mask, SIGCHLD);
+#ifdef SIGWINCH
+    sigdelset(&mask, SIGWINCH);
+#endif
+    if (intrap)
+	for (i = 1; i < SIGCOUNT; i++)
+	    if (sigtrapped[i] && sigtrapped[i] != ZSIG_IGNORED)
+		sigdelset(&mask, i);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigdefault(&attr, &sigdef);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setflags(&attr,
+			     POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+    gettimeofday(&bgtime, &dummy_tz);
+    queue_signals();
+    ret = posix_spawn(&pid, pth, &fa, &attr, argv, envp);
+    unqueue_signals();
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+    if (ret)
+	return 0;
+
+    addproc(pid, text, 0, &bgtime, -1, -1);
+    if (oautocont >= 0)
+	opts[AUTOCONTINUE] = oautocont;
+    pipecleanfilelist(jobtab[thisjob].filelist, 1);
+    return pid;
+}
+
+/**/
+#endif /* USE_POSIX_SPAWN */
+
 /**/
 static int
 execcmd_fork(Estate state, int how, int type, Wordcode varspc,
@@ -3628,6 +3887,18 @@ execcmd_exec(Estate state, Execcmd_params eparams,
 	    (((is_builtin || is_shfunc) && output) ||
 	     (!is_cursh && (last1 != 1 || nsigtrapped || havefiles() ||
 			    fdtable_flocks)))) {
+#ifdef USE_POSIX_SPAWN
+	    if (!is_cursh && type == WC_SIMPLE && !(how & Z_ASYNC) &&
+		!input && !output && (!redir || empty(redir)) &&
+		!eparams->htok && !use_defpath &&
+		!(cflags & (BINF_DASH|BINF_CLEARENV)) &&
+		isset(EXECOPT) && !errflag &&
+		unset(MONITOR) && unset(XTRACE)) {
+		child_block();
+		if (execcmd_spawn(state, varspc, args, hn, text, oautocont))
+		    return;
+	    }
+#endif
 	    switch (execcmd_fork(state, how, type, varspc, &filelist,
 				 text, oautocont, close_if_forked)) {
 	    case -1:
@@ -4760,6 +5031,14 @@ getoutput(char *cmd, int qt)
     return NULL;
 }
 
+/*
+ * Size of the chunks read from the pipe in readoutput().  This is
+ * the size of a typical pipe buffer, so a producer that writes
+ * quickly can be drained with one read() per buffer full.
+ */
+
+#define READOUTPUT_CHUNK 65536
+
 /* read output of command substitution
  *
  * The file descriptor "in" is closed by the function.
@@ -4775,12 +5054,20 @@ mod_export LinkList
 readoutput(int in, int qt, int *readerror)
 {
     LinkList ret;
-    char *buf, *bufptr, *ptr, inbuf[64];
-    int bsiz, c, cnt = 0, readret;
+    char *buf, *bufptr, *ptr, *inbuf, *inend;
+    int bsiz, insiz, c, cnt = 0, readret;
     int q = queue_signal_level();
 
     ret = newlinklist();
-    ptr = buf = (char *) hcalloc(bsiz = 64);
+    /*
+     * The input chunk starts small so that the common case of a
+     * short substitution stays cheap; it grows each time a read fills
+     * it, up to READOUTPUT_CHUNK.  It is allocated off the heap so
+     * that the output buffer remains the most recent heap allocation
+     * and hrealloc() can usually extend it in place.
+     */
+    inbuf = (char *) zalloc(insiz = 256);
+    ptr = buf = (char *) zhalloc(bsiz = 256);
     /*
      * We need to be sensitive to SIGCHLD else we can be
      * stuck forever with important processes unreaped.
@@ -4791,34 +5078,48 @@ readoutput(int in, int qt, int *readerror)
     dont_queue_signals();
     child_unblock();
     for (;;) {
-	readret = read(in, inbuf, 64);
+	readret = read(in, inbuf, insiz);
 	if (readret <= 0) {
 	    if (readret < 0 && errno == EINTR)
 		continue;
 	    else
 		break;
 	}
-	for (bufptr = inbuf; bufptr < inbuf + readret; bufptr++) {
+	/*
+	 * Make sure there is room for the whole chunk even if every
+	 * byte needs metafying, plus the terminating NUL and a
+	 * possible Nularg, so the copy loop needs no checks.
+	 */
+	if (cnt + 2 * readret + 2 > bsiz) {
+	    int nsiz = bsiz;
+	    while (cnt + 2 * readret + 2 > nsiz)
+		nsiz *= 2;
+	    queue_signals();
+	    buf = (char *) hrealloc(buf, bsiz, nsiz);
+	    dont_queue_signals();
+	    bsiz = nsiz;
+	    ptr = buf + cnt;
+	}
+	for (bufptr = inbuf, inend = inbuf + readret; bufptr < inend;
+	     bufptr++) {
 	    c = *bufptr;
 	    if (imeta(c)) {
 		*ptr++ = Meta;
 		c ^= 32;
-		cnt++;
-	    }
-	    if (++cnt >= bsiz) {
-		char *pp;
-		queue_signals();
-		pp = (char *) hcalloc(bsiz *= 2);
-		dont_queue_signals();
-
-		memcpy(pp, buf, cnt - 1);
-		ptr = (buf = pp) + cnt - 1;
 	    }
 	    *ptr++ = c;
 	}
+	cnt = ptr - buf;
+	if (readret == insiz && insiz < READOUTPUT_CHUNK) {
+	    queue_signals();
+	    zfree(inbuf, insiz);
+	    inbuf = (char *) zalloc(insiz *= 4);
+	    dont_queue_signals();
+	}
     }
     child_block();
     restore_queue_signals(q);
+    zfree(inbuf, insiz);
     if (readerror)
 	*readerror = readret < 0 ? errno : 0;
     close(in);
@@ -6218,6 +6519,12 @@ getfpfunc(char *s, int *ksh, char **fdir, char **alt_path, int test_only)
 			*fdir = *pp;
 		    return &dummy_eprog;
 		}
+		if ((r = try_wccache_file(buf, s, &st, ksh))) {
+		    close(fd);
+		    if (fdir)
+			*fdir = *pp;
+		    return r;
+		}
 		d = (char *) zalloc(len + 1);
 		lseek(fd, 0, 0);
 		if ((rlen = read(fd, d, len)) >= 0) {
@@ -6231,6 +6538,9 @@ getfpfunc(char *s, int *ksh, char **fdir, char **alt_path, int test_only)
 		    r = parse_string(d, 1);
 		    scriptname = oldscriptname;
 
+		    if (r && !errflag)
+			write_wccache_file(buf, s, &st, r);
+
 		    if (fdir)
 			*fdir = *pp;
 
@@ -45,6 +45,11 @@ struct gmatch {
     char *name;
     /* Unmetafied file name; embedded nulls can't occur in file names */
     char *uname;
+    /*
+     * Collation key for uname from zstrxfrm() when sorting by name
+     * non-numerically, else NULL.
+     */
+    char *collkey;
     /*
      * Array of sort strings:  one for each GS_EXEC sort type in
      * the glob qualifiers.
@@ -334,40 +339,103 @@ statfullpath(const char *s, struct stat *st, int l)
     }
 }
 
+/*
+ * As statfullpath(), for a file s being read from the open
+ * directory dir, which is the current path.  Where we can, stat
+ * it relative to the directory, which saves the system looking up
+ * the whole path again.
+ */
+
+static int
+statdirentry(DIR *dir, const char *s, struct stat *st, int l)
+{
+#if defined(HAVE_FSTATAT) && defined(HAVE_DIRFD) && defined(AT_SYMLINK_NOFOLLOW)
+    int fd = dirfd(dir);
+
+    if (fd >= 0)
+	return fstatat(fd, unmeta(s), st, l ? AT_SYMLINK_NOFOLLOW : 0);
+#endif
+    return statfullpath(s, st, l);
+}
+
 /* This may be set by qualifier functions to an array of strings to insert
  * into the list instead of the original string. */
 
 static char **inserts;
 
-/* add a match to the list */
+/*
+ * Check whether all the qualifiers for the current glob need
+ * nothing more than the type of the file.
+ */
+
+/**/
+static int
+qualstypeonly(void)
+{
+    struct qual *qo, *qn;
+
+    for (qo = quals; qo; qo = qo->or)
+	for (qn = qo; qn && qn->func; qn = qn->next)
+	    if (qn->func != qualisdir && qn->func != qualisreg &&
+		qn->func != qualislnk && qn->func != qualisfifo &&
+		qn->func != qualissock && qn->func != qualisdev &&
+		qn->func != qualisblk && qn->func != qualischr)
+		return 0;
+    return 1;
+}
+
+/*
+ * Add a match to the list.
+ *
+ * If checked is set, we already know the file exists.  If ftype
+ * is non-zero, it's the file type (S_IFMT bits) from the directory
+ * entry, which can save us a stat() if that's all we need.
+ */
 
 /**/
 static void
-insert(char *s, int checked)
+insert(char *s, int checked, mode_t ftype)
 {
     struct stat buf, buf2, *bp;
     char *news = s;
-    int statted = 0;
+    int statted = 0, typeonly = 0;
 
     queue_signals();
     inserts = NULL;
 
+    /*
+     * For a file that isn't a symbolic link, following links
+     * makes no difference, so if all we need to know is the type
+     * we can use the one from the directory entry.  In that case
+     * buf is filled in with only the type, so the file isn't
+     * marked as statted and sorting still gets the full details.
+     */
+    if (checked && ftype && !S_ISLNK(ftype) && !gf_listtypes &&
+	(qualct || qualorct ? qualstypeonly() : gf_markdirs)) {
+	memset(&buf, 0, sizeof(buf));
+	buf.st_mode = ftype;
+	memcpy(&buf2, &buf, sizeof(buf));
+	typeonly = 1;
+    }
+
     if (gf_listtypes || gf_markdirs) {
 	/* Add the type marker to the end of the filename */
 	mode_t mode;
-	if (statfullpath(s, &buf, 1)) {
+	if (typeonly)
+	    mode = ftype;
+	else if (statfullpath(s, &buf, 1)) {
 	    unqueue_signals();
 	    return;
 	}
 	else {
 	    checked = statted = 1;
-	}
-	mode = buf.st_mode;
-	if (gf_follow) {
-	    if (!S_ISLNK(mode) || statfullpath(s, &buf2, 0))
-		memcpy(&buf2, &buf, sizeof(buf));
-	    statted |= 2;
-	    mode = buf2.st_mode;
+	    mode = buf.st_mode;
+	    if (gf_follow) {
+		if (!S_ISLNK(mode) || statfullpath(s, &buf2, 0))
+		    memcpy(&buf2, &buf, sizeof(buf));
+		statted |= 2;
+		mode = buf2.st_mode;
+	    }
 	}
 	if (gf_listtypes || S_ISDIR(mode)) {
 	    int ll = strlen(s);
@@ -382,19 +450,20 @@ insert(char *s, int checked)
 	/* Go through the qualifiers, rejecting the file if appropriate */
 	struct qual *qo, *qn;
 
-	if (!statted && statfullpath(s, &buf, 1)) {
+	if (!statted && !typeonly && statfullpath(s, &buf, 1)) {
 	    unqueue_signals();
 	    return;
 	}
 	news = dyncat(pathbuf, news);
 
-	statted = 1;
+	if (!typeonly)
+	    statted |= 1;
 	qo = quals;
 	for (qn = qo; qn && qn->func;) {
 	    g_range = qn->range;
 	    g_amc = qn->amc;
 	    g_units = qn->units;
-	    if ((qn->sense & 2) && !(statted & 2)) {
+	    if ((qn->sense & 2) && !(statted & 2) && !typeonly) {
 		/* If (sense & 2), we're following links */
 		if (!S_ISLNK(buf.st_mode) || statfullpath(s, &buf2, 0))
 		    memcpy(&buf2, &buf, sizeof(buf));
@@ -505,6 +574,8 @@ scanner(Complist q, int shortcircuit)
     int errssofar = errsfound;
     struct dirsav ds;
 
+    if (inputcancel)
+	checkinputcancel();
     if (!q || errflag)
 	return;
     init_dirsav(&ds);
@@ -573,7 +644,7 @@ scanner(Complist q, int shortcircuit)
 	} else {
 	    if (str[l])
 		str = dupstrpfx(str, l);
-	    insert(str, 0);
+	    insert(str, 0, 0);
 	    if (shortcircuit && shortcircuit == matchct)
 		return;
 	}
@@ -584,10 +655,11 @@ scanner(Complist q, int shortcircuit)
 	DIR *lock = opendir(fn);
 	char *subdirs = NULL;
 	int subdirlen = 0;
+	mode_t ftype;
 
 	if (lock == NULL)
 	    return;
-	while ((fn = zreaddir(lock, 1)) && !errflag) {
+	while ((fn = zreaddirtype(lock, 1, &ftype)) && !errflag) {
 	    /* prefix and suffix are zle trickery */
 	    if (!dirs && !colonmod &&
 		((glob_pre && !strpfx(glob_pre, fn))
@@ -644,14 +716,22 @@ scanner(Complist q, int shortcircuit)
 			/* if matching multiple directories */
 			struct stat buf;
 
-			if (statfullpath(fn, &buf, !q->follow)) {
-			    if (errno != ENOENT && errno != EINTR &&
-				errno != ENOTDIR && !errflag) {
-				zwarn("%e: %s", errno, fn);
+			/*
+			 * If the directory entry gave us the type of
+			 * file we don't need to stat it, unless it's
+			 * a symbolic link we need to follow.
+			 */
+			if (!ftype || (S_ISLNK(ftype) && q->follow)) {
+			    if (statdirentry(lock, fn, &buf, !q->follow)) {
+				if (errno != ENOENT && errno != EINTR &&
+				    errno != ENOTDIR && !errflag) {
+				    zwarn("%e: %s", errno, fn);
+				}
+				continue;
 			    }
-			    continue;
+			    ftype = buf.st_mode;
 			}
-			if (!S_ISDIR(buf.st_mode))
+			if (!S_ISDIR(ftype))
 			    continue;
 		    }
 		    l = strlen(fn) + 1;
@@ -665,7 +745,7 @@ scanner(Complist q, int shortcircuit)
 		    subdirlen += sizeof(int);
 		} else {
 		    /* if the last filename component, just add it */
-		    insert(fn, 1);
+		    insert(fn, 1, ftype);
 		    if (shortcircuit && shortcircuit == matchct) {
 			closedir(lock);
 			return;
@@ -943,8 +1023,11 @@ gmatchcmp(Gmatch a, Gmatch b)
     for (i = gf_nsorts, s = gf_sortlist; i; i--, s++) {
 	switch (s->tp & ~GS_DESC) {
 	case GS_NAME:
-	    r = zstrcmp(b->uname, a->uname,
-			gf_numsort ? SORTIT_NUMERICALLY : 0);
+	    if (a->collkey)
+		r = strcmp(b->collkey, a->collkey);
+	    else
+		r = zstrcmp(b->uname, a->uname,
+			    gf_numsort ? SORTIT_NUMERICALLY : 0);
 	    break;
 	case GS_DEPTH:
 	    {
@@ -1886,7 +1969,7 @@ zglob(LinkList list, LinkNode np, int nountok)
 	 * Get the strings to use for sorting by executing
 	 * the code chunk.  We allow more than one of these.
 	 */
-	int nexecs = 0;
+	int nexecs = 0, byname = 0;
 	struct globsort *sortp;
 	struct globsort *lastsortp = gf_sortlist + gf_nsorts;
 	Gmatch gmptr;
@@ -1896,6 +1979,8 @@ zglob(LinkList list, LinkNode np, int nountok)
 	{
 	    if (sortp->tp & GS_EXEC)
 		nexecs++;
+	    else if ((sortp->tp & ~GS_DESC) == GS_NAME)
+		byname = 1;
 	}
 
 	if (nexecs) {
@@ -1956,6 +2041,17 @@ zglob(LinkList list, LinkNode np, int nountok)
 	    } else {
 		gmptr->uname = gmptr->name;
 	    }
+	    gmptr->collkey = NULL;
+	}
+
+	/*
+	 * When there are enough names, transform each once for
+	 * collation rather than calling strcoll() on every comparison.
+	 */
+	if (byname && !gf_numsort && matchct >= 16 &&
+	    (matchbuf->collkey = zstrxfrm(matchbuf->uname))) {
+	    for (gmptr = matchbuf + 1; gmptr < matchptr; gmptr++)
+		gmptr->collkey = zstrxfrm(gmptr->uname);
 	}
 
 	/* Sort arguments in to lexical (and possibly numeric) order. *
@@ -2852,17 +2948,7 @@ igetmatch(char **sp, Patprog p, int fl, int n, char *replstr,
     {
 	char *muststr = (char *)p + p->mustoff;
 
-	matched = 0;
-	if (p->patmlen <= umltot)
-	{
-	    for (t = s; t <= send - p->patmlen; t++)
-	    {
-		if (!memcmp(muststr, t, p->patmlen)) {
-		    matched = 1;
-		    break;
-		}
-	    }
-	}
+	matched = patfindstr(s, umltot, muststr, p->patmlen) != NULL;
     }
 
     /* in case we used the prog before... */
@@ -3258,17 +3344,7 @@ igetmatch(char **sp, Patprog p, int fl, int n, char *replstr,
     {
 	char *muststr = (char *)p + p->mustoff;
 
-	matched = 0;
-	if (p->patmlen <= uml)
-	{
-	    for (t = s; t <= send - p->patmlen; t++)
-	    {
-		if (!memcmp(muststr, t, p->patmlen)) {
-		    matched = 1;
-		    break;
-		}
-	    }
-	}
+	matched = patfindstr(s, uml, muststr, p->patmlen) != NULL;
     }
 
     /* in case we used the prog before... */
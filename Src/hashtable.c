@@ -41,6 +41,9 @@ struct hashtableimpl {
 
     /* HASHTABLE INTERNAL MEMBERS */
     ScanStatus scan;		/* status of a scan over this hashtable     */
+    char **keys;		/* cached node names, see hashtablekeys()   */
+    int keysct;			/* number of names in keys                  */
+    int keysflags;		/* flags2 the cached names were built with  */
 
 #ifdef ZSH_HASH_DEBUG
     /* HASHTABLE DEBUG MEMBERS */
@@ -117,6 +120,7 @@ newhashtable(int size, UNUSED(char const *name), UNUSED(PrintTableStats printinf
     ht->pub.hsize = size;
     ht->pub.ct = 0;
     ht->scan = NULL;
+    ht->keys = NULL;
     ht->pub.scantab = NULL;
     return &ht->pub;
 }
@@ -140,6 +144,7 @@ deletehashtable(HashTable ht)
 	firstht = impl(ht)->next;
     zsfree(impl(ht)->tablename);
 #endif /* ZSH_HASH_DEBUG */
+    freehashkeys(ht);
     zfree(ht->nodes, ht->hsize * sizeof(HashNode));
     zfree(ht, sizeof(struct hashtableimpl));
 }
@@ -172,6 +177,7 @@ addhashnode2(HashTable ht, char *nam, void *nodeptr)
 
     hn = (HashNode) nodeptr;
     hn->nam = nam;
+    freehashkeys(ht);
 
     hashval = ht->hash(hn->nam) % ht->hsize;
     hp = ht->nodes[hashval];
@@ -289,6 +295,7 @@ removehashnode(HashTable ht, const char *nam)
 	ht->nodes[hashval] = hp->next;
 	gotit:
 	ht->ct--;
+	freehashkeys(ht);
 	if(impl(ht)->scan) {
 	    if(impl(ht)->scan->sorted) {
 		HashNode *hashtab = impl(ht)->scan->u.s.hashtab;
@@ -316,6 +323,76 @@ removehashnode(HashTable ht, const char *nam)
     return NULL;
 }
 
+/* Forget the list of names cached by hashtablekeys(). */
+
+/**/
+static void
+freehashkeys(HashTable ht)
+{
+    if (impl(ht)->keys) {
+	zfree(impl(ht)->keys, (impl(ht)->keysct + 1) * sizeof(char *));
+	impl(ht)->keys = NULL;
+    }
+}
+
+/*
+ * Return the names of the nodes in ht which have none of the flags
+ * in flags2 set, in hash order, as a NULL-terminated array on the heap.
+ * The number of names is stored in *ctp.
+ *
+ * The list is kept with the table until a node is added, replaced or
+ * removed, so asking again for an unchanged table only costs a copy.
+ * Nodes whose flags change in place are not noticed, so the list is
+ * not kept if any node was left out; for parameter tables this only
+ * happens in the short window where an element is created unset.
+ *
+ * Returns NULL if the table is generated on the fly by a module.
+ */
+
+/**/
+mod_export char **
+hashtablekeys(HashTable ht, int flags2, int *ctp)
+{
+    char **keys, **ret;
+    int ct;
+
+    if (ht->scantab)
+	return NULL;
+    if (impl(ht)->keys && impl(ht)->keysflags != flags2)
+	freehashkeys(ht);
+    if (impl(ht)->keys) {
+	keys = impl(ht)->keys;
+	ct = impl(ht)->keysct;
+    } else {
+	HashNode hn;
+	int i, skipped = 0;
+
+	keys = (char **) zalloc((ht->ct + 1) * sizeof(char *));
+	for (ct = i = 0; i < ht->hsize; i++)
+	    for (hn = ht->nodes[i]; hn; hn = hn->next) {
+		if (hn->flags & flags2)
+		    skipped = 1;
+		else
+		    keys[ct++] = hn->nam;
+	    }
+	keys[ct] = NULL;
+	if (skipped) {
+	    ret = (char **) zhalloc((ct + 1) * sizeof(char *));
+	    memcpy(ret, keys, (ct + 1) * sizeof(char *));
+	    zfree(keys, (ht->ct + 1) * sizeof(char *));
+	    *ctp = ct;
+	    return ret;
+	}
+	impl(ht)->keys = keys;
+	impl(ht)->keysct = ct;
+	impl(ht)->keysflags = flags2;
+    }
+    ret = (char **) zhalloc((ct + 1) * sizeof(char *));
+    memcpy(ret, keys, (ct + 1) * sizeof(char *));
+    *ctp = ct;
+    return ret;
+}
+
 /* Disable a node in a hash table */
 
 /**/
@@ -451,13 +528,17 @@ scanhashtable(HashTable ht, int sorted, int flags1, int flags2,
 }
 
 /* Expand hash tables when they get too many entries. *
- * The new size is 4 times the previous size.         */
+ * The new size is 4 times the previous size.         *
+ * The nodes are moved directly onto the new chains:  *
+ * their keys are already known to be unique, so this *
+ * doesn't need the comparisons done by addnode.      */
 
 /**/
 static void
 expandhashtable(HashTable ht)
 {
     struct hashnode **onodes, **ha, *hn, *hp;
+    unsigned hashval;
     int i, osize;
 
     osize = ht->hsize;
@@ -465,14 +546,15 @@ expandhashtable(HashTable ht)
 
     ht->hsize = osize * 4;
     ht->nodes = (HashNode *) zshcalloc(ht->hsize * sizeof(HashNode));
-    ht->ct = 0;
 
     /* scan through the old list of nodes, and *
      * rehash them into the new list of nodes  */
     for (i = 0, ha = onodes; i < osize; i++, ha++) {
 	for (hn = *ha; hn;) {
 	    hp = hn->next;
-	    ht->addnode(ht, hn->nam, hn);
+	    hashval = ht->hash(hn->nam) % ht->hsize;
+	    hn->next = ht->nodes[hashval];
+	    ht->nodes[hashval] = hn;
 	    hn = hp;
 	}
     }
@@ -488,6 +570,8 @@ resizehashtable(HashTable ht, int newsize)
     struct hashnode **ha, *hn, *hp;
     int i;
 
+    freehashkeys(ht);
+
     /* free all the hash nodes */
     ha = ht->nodes;
     for (i = 0; i < ht->hsize; i++, ha++) {
@@ -626,6 +710,114 @@ emptycmdnamtable(HashTable ht)
     pathchecked = path;
 }
 
+/*
+ * Cache of the names found in each directory scanned by hashdir(),
+ * so that rebuilding the command table after a rehash only needs
+ * to read directories that have changed since they were last read.
+ * An entry is valid as long as the directory has the same device,
+ * inode and modification time.
+ */
+
+typedef struct cmddir *Cmddir;
+
+struct cmddir {
+    struct hashnode node;	/* node.nam is the (metafied) directory */
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+#ifdef GET_ST_MTIME_NSEC
+    long mtime_nsec;
+#endif
+    char **names;		/* candidate command names, metafied */
+};
+
+static HashTable cmddirtab;
+
+/**/
+static void
+freecmddirnode(HashNode hn)
+{
+    Cmddir cd = (Cmddir) hn;
+
+    zsfree(cd->node.nam);
+    freearray(cd->names);
+    zfree(cd, sizeof(struct cmddir));
+}
+
+/* Look up the cached names for a directory, discarding them if stale. */
+
+/**/
+static char **
+getcmddirnames(char *dir, struct stat *st)
+{
+    Cmddir cd;
+
+    if (!cmddirtab ||
+	!(cd = (Cmddir) cmddirtab->getnode(cmddirtab, dir)))
+	return NULL;
+    if (cd->dev == st->st_dev && cd->ino == st->st_ino &&
+	cd->mtime == st->st_mtime
+#ifdef GET_ST_MTIME_NSEC
+	&& cd->mtime_nsec == GET_ST_MTIME_NSEC(*st)
+#endif
+	)
+	return cd->names;
+    cmddirtab->freenode(cmddirtab->removenode(cmddirtab, dir));
+    return NULL;
+}
+
+/* Remember the names read from a directory. */
+
+/**/
+static void
+addcmddir(char *dir, struct stat *st, LinkList names)
+{
+    Cmddir cd;
+
+    if (!cmddirtab) {
+	cmddirtab = newhashtable(17, "cmddirtab", NULL);
+
+	cmddirtab->hash        = hasher;
+	cmddirtab->emptytable  = emptyhashtable;
+	cmddirtab->filltable   = NULL;
+	cmddirtab->cmpnodes    = strcmp;
+	cmddirtab->addnode     = addhashnode;
+	cmddirtab->getnode     = gethashnode2;
+	cmddirtab->getnode2    = gethashnode2;
+	cmddirtab->removenode  = removehashnode;
+	cmddirtab->disablenode = NULL;
+	cmddirtab->enablenode  = NULL;
+	cmddirtab->freenode    = freecmddirnode;
+	cmddirtab->printnode   = NULL;
+    }
+    cd = (Cmddir) zshcalloc(sizeof *cd);
+    cd->dev = st->st_dev;
+    cd->ino = st->st_ino;
+    cd->mtime = st->st_mtime;
+#ifdef GET_ST_MTIME_NSEC
+    cd->mtime_nsec = GET_ST_MTIME_NSEC(*st);
+#endif
+    cd->names = zlinklist2array(names, 0);
+    cmddirtab->addnode(cmddirtab, ztrdup(dir), cd);
+}
+
+/* Add a command name found in a given directory to the *
+ * command hashtable, unless an earlier one shadows it.  */
+
+/**/
+static void
+hashdirname(char **dirp, char *fn)
+{
+    Cmdnam cn;
+
+    if (!cmdnamtab->getnode(cmdnamtab, fn)) {
+	cn = (Cmdnam) slabcalloc(sizeof *cn);
+	cn->node.flags = 0;
+	cn->u.name = dirp;
+	cmdnamtab->addnode(cmdnamtab, ztrdup(fn), cn);
+    }
+}
+
 /* Add all commands in a given directory *
  * to the command hashtable.             */
 
@@ -635,8 +827,10 @@ hashdir(char **dirp)
 {
     Cmdnam cn;
     DIR *dir;
-    char *fn, *unmetadir, *pathbuf, *pathptr;
+    char *fn, *unmetadir, *pathbuf, *pathptr, **np;
     int dirlen;
+    struct stat dirstat;
+    LinkList names = NULL;
 #if defined(_WIN32) || defined(__CYGWIN__)
     char *exe;
 #endif /* _WIN32 || _CYGWIN__ */
@@ -644,8 +838,28 @@ hashdir(char **dirp)
     if (isrelative(*dirp))
 	return;
     unmetadir = unmeta(*dirp);
-    if (!(dir = opendir(unmetadir)))
+    /*
+     * Whether a file is executable can change without the directory
+     * changing, so the cache is only used when every name is hashed.
+     */
+    if (unset(HASHEXECUTABLESONLY) && !stat(unmetadir, &dirstat)) {
+	if ((np = getcmddirnames(*dirp, &dirstat))) {
+	    for (; *np; np++)
+		hashdirname(dirp, *np);
+	    return;
+	}
+	/*
+	 * Don't trust a modification time from the current second:
+	 * the directory may yet change again without the time changing.
+	 */
+	if (dirstat.st_mtime < time(NULL))
+	    names = znewlinklist();
+    }
+    if (!(dir = opendir(unmetadir))) {
+	if (names)
+	    freelinklist(names, freestr);
 	return;
+    }
 
     dirlen = strlen(unmetadir);
     pathbuf = (char *)zalloc(dirlen + PATH_MAX + 2);
@@ -653,6 +867,8 @@ hashdir(char **dirp)
     pathptr = pathbuf + dirlen + 1;
 
     while ((fn = zreaddir(dir, 1))) {
+	if (names)
+	    zaddlinknode(names, ztrdup(fn));
 	if (!cmdnamtab->getnode(cmdnamtab, fn)) {
 	    char *fname = ztrdup(fn);
 	    struct stat statbuf;
@@ -675,7 +891,7 @@ hashdir(char **dirp)
 		    add = 1;
 	    }
 	    if (add) {
-		cn = (Cmdnam) zshcalloc(sizeof *cn);
+		cn = (Cmdnam) slabcalloc(sizeof *cn);
 		cn->node.flags = 0;
 		cn->u.name = dirp;
 		cmdnamtab->addnode(cmdnamtab, fname, cn);
@@ -691,17 +907,18 @@ hashdir(char **dirp)
 	    (exe[2] == 'X' || exe[2] == 'x') &&
 	    (exe[3] == 'E' || exe[3] == 'e') && exe[4] == 0) {
 	    *exe = 0;
-	    if (!cmdnamtab->getnode(cmdnamtab, fn)) {
-		cn = (Cmdnam) zshcalloc(sizeof *cn);
-		cn->node.flags = 0;
-		cn->u.name = dirp;
-		cmdnamtab->addnode(cmdnamtab, ztrdup(fn), cn);
-	    }
+	    if (names)
+		zaddlinknode(names, ztrdup(fn));
+	    hashdirname(dirp, fn);
 	}
 #endif /* _WIN32 || __CYGWIN__ */
     }
     closedir(dir);
     zfree(pathbuf, dirlen + PATH_MAX + 2);
+    if (names) {
+	addcmddir(*dirp, &dirstat, names);
+	freelinklist(names, NULL);
+    }
 }
 
 /* Go through user's PATH and add everything to *
@@ -729,7 +946,7 @@ freecmdnamnode(HashNode hn)
     if (cn->node.flags & HASHED)
 	zsfree(cn->u.cmd);
  
-    zfree(cn, sizeof(struct cmdnam));
+    slabfree(cn, sizeof(struct cmdnam));
 }
 
 /* Print an element of the cmdnamtab hash table (external command) */
@@ -1231,7 +1448,7 @@ createaliasnode(char *txt, int flags)
 {
     Alias al;
 
-    al = (Alias) zshcalloc(sizeof *al);
+    al = (Alias) slabcalloc(sizeof *al);
     al->node.flags = flags;
     al->text = txt;
     al->inuse = 0;
@@ -1246,7 +1463,7 @@ freealiasnode(HashNode hn)
  
     zsfree(al->node.nam);
     zsfree(al->text);
-    zfree(al, sizeof(struct alias));
+    slabfree(al, sizeof(struct alias));
 }
 
 /* Print an alias */
@@ -1442,7 +1659,7 @@ void
 freehistnode(HashNode nodeptr)
 {
     freehistdata((Histent)nodeptr, 1);
-    zfree(nodeptr, sizeof (struct histent));
+    slabfree(nodeptr, sizeof (struct histent));
 }
 
 /**/
@@ -216,11 +216,17 @@ static zlong defev;
  */
 static int hist_keep_comment;
 
-/* Remember the last line in the history file so we can find it again. */
+/*
+ * Remember the last line in the history file so we can find it again.
+ * The device and inode tell us whether the file has since been
+ * replaced, in which case the offset is no use.
+ */
 static struct histfile_stats {
     char *text;
     time_t stim, mtim;
     off_t fpos, fsiz;
+    dev_t dev;
+    ino_t ino;
     int interrupted;
     zlong next_write_ev;
 } lasthist;
@@ -1397,7 +1403,7 @@ prepnexthistent(void)
     }
 
     if (histlinect < histsiz || !hist_ring) {
-	he = (Histent)zshcalloc(sizeof *he);
+	he = (Histent)slabcalloc(sizeof *he);
 	if (!hist_ring)
 	    hist_ring = he->up = he->down = he;
 	else {
@@ -1617,6 +1623,7 @@ hend(Eprog prog)
 	he->stim = time(NULL);
 	he->ftim = 0L;
 	he->node.flags = newflags;
+	histsettrigrams(he);
 
 	if ((he->nwords = chwordpos/2)) {
 	    he->words = (short *)zalloc(chwordpos * sizeof(short));
@@ -1824,6 +1831,89 @@ getargspec(int argc, int marg, int evset)
     return ret;
 }
 
+/*
+ * Trigram signatures of history lines.
+ *
+ * Every line in the history has a bitmask with a bit set for each
+ * (hashed) sequence of three characters it contains, ignoring ASCII
+ * case.  A string can only occur in lines whose mask includes that of
+ * the string, so searches skip most lines without looking at the text.
+ * Lines with characters outside ASCII, where the case can't be ignored
+ * so easily, have every bit set.
+ */
+
+#define TRIGRAM_BITS (HIST_TRIGRAM_WORDS * 32)
+
+static int
+trigramhash(const char *s)
+{
+    unsigned int t = 0;
+    int i;
+
+    for (i = 0; i < 3; i++) {
+	int c = s[i];
+	if (c >= 'A' && c <= 'Z')
+	    c += 'a' - 'A';
+	t = (t << 8) | c;
+    }
+    return ((t * 2654435761U) >> 16) % TRIGRAM_BITS;
+}
+
+/*
+ * Set mask to the signature of the metafied string s.  For a history
+ * line, anything not ASCII sets every bit; for a search string,
+ * sequences containing such characters are ignored.
+ */
+
+/**/
+mod_export void
+histtrigrams(const char *s, unsigned int *mask, int line)
+{
+    int h;
+
+    memset(mask, 0, HIST_TRIGRAM_WORDS * sizeof(unsigned int));
+    for (; s[0] && s[1] && s[2]; s++) {
+	if ((s[0] | s[1] | s[2]) & 0x80) {
+	    if (line) {
+		memset(mask, 0xff, HIST_TRIGRAM_WORDS * sizeof(unsigned int));
+		return;
+	    }
+	    continue;
+	}
+	h = trigramhash(s);
+	mask[h / 32] |= 1U << (h % 32);
+    }
+}
+
+/* Record the signature of a history line once its text is set */
+
+/**/
+mod_export void
+histsettrigrams(Histent he)
+{
+    histtrigrams(he->node.nam, he->trigrams, 1);
+    he->node.flags |= HIST_TRIGRAMS;
+}
+
+/*
+ * Return 0 if the text of he can't contain a string with signature
+ * mask, else 1.
+ */
+
+/**/
+mod_export int
+histmaycontain(Histent he, unsigned int *mask)
+{
+    int i;
+
+    if (!(he->node.flags & HIST_TRIGRAMS) || he->zle_text)
+	return 1;
+    for (i = 0; i < HIST_TRIGRAM_WORDS; i++)
+	if ((he->trigrams[i] & mask[i]) != mask[i])
+	    return 0;
+    return 1;
+}
+
 /* do ?foo? search */
 
 /**/
@@ -1833,9 +1923,11 @@ hconsearch(char *str, int *marg)
     int t1 = 0;
     char *s;
     Histent he;
+    unsigned int mask[HIST_TRIGRAM_WORDS];
 
+    histtrigrams(str, mask, 0);
     for (he = up_histent(hist_ring); he; he = up_histent(he)) {
-	if (he->node.flags & HIST_FOREIGN)
+	if (he->node.flags & HIST_FOREIGN || !histmaycontain(he, mask))
 	    continue;
 	if ((s = strstr(he->node.nam, str))) {
 	    int pos = s - he->node.nam;
@@ -1856,9 +1948,11 @@ hcomsearch(char *str)
 {
     Histent he;
     int len = strlen(str);
+    unsigned int mask[HIST_TRIGRAM_WORDS];
 
+    histtrigrams(str, mask, 0);
     for (he = up_histent(hist_ring); he; he = up_histent(he)) {
-	if (he->node.flags & HIST_FOREIGN)
+	if (he->node.flags & HIST_FOREIGN || !histmaycontain(he, mask))
 	    continue;
 	if (strncmp(he->node.nam, str, len) == 0)
 	    return he->histnum;
@@ -2676,15 +2770,16 @@ readhistfile(char *fn, int err, int readflags)
     short *words;
     struct stat sb;
     int nwordpos, nwords, bufsiz;
-    int searching, newflags, l, ret, uselex, readbytes;
+    int searching, newflags, l, ret, uselex, readbytes, replaced;
 
     if (!fn && !(fn = getsparam("HISTFILE")))
 	return;
     if (stat(unmeta(fn), &sb) < 0 ||
 	sb.st_size == 0)
 	return;
+    replaced = lasthist.dev != sb.st_dev || lasthist.ino != sb.st_ino;
     if (readflags & HFILE_FAST) {
-	if (!lasthist.interrupted &&
+	if (!lasthist.interrupted && !replaced &&
 	    ((lasthist.fsiz == sb.st_size && lasthist.mtim == sb.st_mtime)
 	     || lockhistfile(fn, 0)))
 	    return;
@@ -2707,7 +2802,13 @@ readhistfile(char *fn, int err, int readflags)
 
 	pushheap();
 	if (readflags & HFILE_FAST && lasthist.text) {
-	    if (lasthist.fpos < lasthist.fsiz) {
+	    /*
+	     * If the file has only been appended to, we can pick up
+	     * where we left off; otherwise it's been rewritten and we
+	     * need to search from the start for the entries we haven't
+	     * seen.
+	     */
+	    if (!replaced && lasthist.fpos < lasthist.fsiz) {
 		fseek(in, lasthist.fpos, SEEK_SET);
 		searching = 1;
 	    }
@@ -2735,6 +2836,17 @@ readhistfile(char *fn, int err, int readflags)
 		break;
 	    }
 
+	    /*
+	     * When searching a rewritten file for new entries, skip
+	     * old ones as early as possible; the timestamp isn't
+	     * affected by the metafication below.
+	     */
+	    if (searching < 0 && *buf == ':' &&
+		zstrtol(buf + 1, NULL, 0) < lasthist.stim) {
+		histfile_linect++;
+		continue;
+	    }
+
 	    /*
 	     * Handle the special case that we're reading from an
 	     * old shell with fewer meta characters, so we need to
@@ -2807,6 +2919,7 @@ readhistfile(char *fn, int err, int readflags)
 	    he = prepnexthistent();
 	    he->node.nam = ztrdup(pt);
 	    he->node.flags = newflags;
+	    histsettrigrams(he);
 	    if ((he->stim = stim) == 0)
 		he->stim = he->ftim = tim;
 	    else if (ftim < stim)
@@ -2844,9 +2957,13 @@ readhistfile(char *fn, int err, int readflags)
 		break;
 	    }
 	}
-	if (start && readflags & HFILE_USE_OPTIONS) {
-	    zsfree(lasthist.text);
-	    lasthist.text = ztrdup(start);
+	if (readflags & HFILE_USE_OPTIONS) {
+	    if (start) {
+		zsfree(lasthist.text);
+		lasthist.text = ztrdup(start);
+	    }
+	    lasthist.dev = sb.st_dev;
+	    lasthist.ino = sb.st_ino;
 	}
 	zfree(words, nwords*sizeof(short));
 	zfree(buf, bufsiz);
@@ -3071,6 +3188,8 @@ savehistfile(char *fn, int err, int writeflags)
 		if (fstat(fileno(out), &sb) == 0) {
 		    lasthist.fsiz = sb.st_size;
 		    lasthist.mtim = sb.st_mtime;
+		    lasthist.dev = sb.st_dev;
+		    lasthist.ino = sb.st_ino;
 		}
 		zsfree(lasthist.text);
 		lasthist.text = ztrdup(start);
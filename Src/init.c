@@ -98,6 +98,9 @@ mod_export struct hookdef zshhooks[] = {
     HOOKDEF("before_trap", NULL, HOOKF_ALL),
     HOOKDEF("after_trap", NULL, HOOKF_ALL),
     HOOKDEF("get_color_attr", NULL, HOOKF_ALL),
+    HOOKDEF("exec_line", NULL, HOOKF_ALL),
+    HOOKDEF("expand_start", NULL, HOOKF_ALL),
+    HOOKDEF("expand_end", NULL, HOOKF_ALL),
 };
 
 /* keep executing lists until EOF found */
@@ -713,11 +716,18 @@ init_io(char *cmd)
 #endif
 }
 
+/* Size of the stdio buffer for shout */
+#define SHOUTBUFSIZ 65536
+
 /**/
 mod_export void
 init_shout(void)
 {
-    static char shoutbuf[BUFSIZ];
+    /*
+     * ZLE writes a whole redisplay before flushing shout, so the
+     * buffer is big enough for most screens to go out in one write().
+     */
+    static char shoutbuf[SHOUTBUFSIZ];
 #if defined(JOB_CONTROL) && defined(TIOCSETD) && defined(NTTYDISC)
     int ldisc;
 #endif
@@ -738,7 +748,7 @@ init_shout(void)
     shout = fdopen(SHTTY, "w");
 #ifdef _IOFBF
     if (shout)
-	setvbuf(shout, shoutbuf, _IOFBF, BUFSIZ);
+	setvbuf(shout, shoutbuf, _IOFBF, SHOUTBUFSIZ);
 #endif
   
     gettyinfo(&shttyinfo);	/* get tty state */
@@ -1390,7 +1390,7 @@ deletefilelist(LinkList file_list, int disowning)
 	    }
 	    zfree(jf, sizeof(*jf));
 	}
-	zfree(file_list, sizeof(struct linklist));
+	slabfree(file_list, sizeof(struct linklist));
     }
 }
 
@@ -1418,14 +1418,14 @@ freejob(Job jn, int deleting)
     jn->procs = NULL;
     for (; pn; pn = nx) {
 	nx = pn->next;
-	zfree(pn, sizeof(struct process));
+	slabfree(pn, sizeof(struct process));
     }
 
     pn = jn->auxprocs;
     jn->auxprocs = NULL;
     for (; pn; pn = nx) {
 	nx = pn->next;
-	zfree(pn, sizeof(struct process));
+	slabfree(pn, sizeof(struct process));
     }
 
     if (jn->ty)
@@ -1497,7 +1497,7 @@ addproc(pid_t pid, char *text, int aux, struct timeval *bgtime,
     Process pn, *pnlist;
 
     DPUTS(thisjob == -1, "No valid job in addproc.");
-    pn = (Process) zshcalloc(sizeof *pn);
+    pn = (Process) slabcalloc(sizeof *pn);
     pn->pid = pid;
     if (text)
 	strcpy(pn->text, text);
@@ -117,7 +117,7 @@ znewlinklist(void)
 {
     LinkList list;
 
-    list = (LinkList) zalloc(sizeof *list);
+    list = (LinkList) slaballoc(sizeof *list);
     if (!list)
 	return NULL;
     list->list.first = NULL;
@@ -153,7 +153,7 @@ zinsertlinknode(LinkList list, LinkNode node, void *dat)
     LinkNode tmp, new;
 
     tmp = node->next;
-    node->next = new = (LinkNode) zalloc(sizeof *tmp);
+    node->next = new = (LinkNode) slaballoc(sizeof *tmp);
     if (!new)
 	return NULL;
     new->prev = node;
@@ -220,7 +220,7 @@ getlinknode(LinkList list)
 	node->next->prev = &list->node;
     else
 	list->list.last = &list->node;
-    zfree(node, sizeof *node);
+    slabfree(node, sizeof *node);
     return dat;
 }
 
@@ -258,7 +258,7 @@ remnode(LinkList list, LinkNode nd)
     else
 	list->list.last = nd->prev;
     dat = nd->dat;
-    zfree(nd, sizeof *nd);
+    slabfree(nd, sizeof *nd);
 
     return dat;
 }
@@ -292,9 +292,9 @@ freelinklist(LinkList list, FreeFunc freefunc)
 	next = node->next;
 	if (freefunc)
 	    freefunc(node->dat);
-	zfree(node, sizeof *node);
+	slabfree(node, sizeof *node);
     }
-    zfree(list, sizeof *list);
+    slabfree(list, sizeof *list);
 }
 
 /* Count the number of nodes in a linked list */
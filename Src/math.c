@@ -329,6 +329,217 @@ enum prec_type {
 };
 
 
+/*
+ * Compiled expressions.
+ *
+ * The parse of an expression doesn't depend on the values involved:
+ * conditions and short-circuit operators only change noeval, and both
+ * sides are parsed regardless.  So the first time a top-level expression
+ * is evaluated we record the calls mathparse() makes to the value stack
+ * and the operators, and later evaluations of the same string simply
+ * replay them, skipping the lexer and the precedence parser.  Variables,
+ * functions and so on are still looked up as the program runs.
+ *
+ * Expressions whose lexical analysis has effects beyond producing
+ * tokens that can't be replayed, such as $$ or $?, are not compiled.
+ * The options affecting the parse are part of the key.
+ */
+
+enum {
+    MO_NUM,			/* push a constant */
+    MO_ID,			/* push a variable */
+    MO_CID,			/* push #var */
+    MO_FUNC,			/* push the result of a function */
+    MO_OPBEGIN,			/* start the operand(s) of an operator */
+    MO_OPEND,			/* apply the operator */
+    MO_QCOND,			/* test the condition of ?: */
+    MO_QELSE,			/* between the branches of ?: */
+    MO_QEND,			/* choose the result of ?: */
+    MO_BASE,			/* set lastbase */
+    MO_RADIX			/* set output radix and underscore */
+};
+
+struct mathop {
+    int code;
+    int arg;			/* operator, or base */
+    union {
+	mnumber num;		/* constant */
+	char *str;		/* variable or function */
+	int radix[2];		/* output radix and underscore */
+    } u;
+};
+
+typedef struct mathprog *Mathprog;
+
+struct mathprog {
+    struct hashnode node;	/* key: option flags and expression */
+    struct mathop *ops;
+    int nops;
+    int ctldepth;		/* depth of nested operators needed */
+    int end;			/* length of expression parsed */
+};
+
+/* Expression being compiled */
+
+struct mathrec {
+    struct mathop *ops;
+    int nops, size;
+    int depth, maxdepth;
+    int nocache;		/* can't be compiled */
+};
+
+static struct mathrec *mrec;
+
+/* Most compiled expressions kept */
+#define MATHCACHE_MAX 256
+
+static HashTable mathcache;
+
+static void runmathprog(Mathprog prog);
+
+/* Number of compiled programs being run; the cache can't be emptied */
+static int mathrunning;
+
+/**/
+static void
+freemathprog(HashNode hn)
+{
+    Mathprog prog = (Mathprog) hn;
+    int i;
+
+    for (i = 0; i < prog->nops; i++)
+	if (prog->ops[i].code == MO_ID || prog->ops[i].code == MO_CID ||
+	    prog->ops[i].code == MO_FUNC)
+	    zsfree(prog->ops[i].u.str);
+    zfree(prog->ops, prog->nops * sizeof(struct mathop));
+    zsfree(prog->node.nam);
+    zfree(prog, sizeof(*prog));
+}
+
+static HashTable
+newmathcache(void)
+{
+    HashTable ht = newhashtable(64, "mathcache", NULL);
+
+    ht->hash        = hasher;
+    ht->emptytable  = emptyhashtable;
+    ht->filltable   = NULL;
+    ht->cmpnodes    = strcmp;
+    ht->addnode     = addhashnode;
+    ht->getnode     = gethashnode2;
+    ht->getnode2    = gethashnode2;
+    ht->removenode  = removehashnode;
+    ht->disablenode = NULL;
+    ht->enablenode  = NULL;
+    ht->freenode    = freemathprog;
+    ht->printnode   = NULL;
+
+    return ht;
+}
+
+/*
+ * Return the key under which expression s is compiled, or NULL if it
+ * can't be.
+ */
+
+static char *
+mathcachekey(char *s)
+{
+    int flags = 0;
+    char *key, *t;
+
+    /* Identifiers outside ASCII depend on the locale */
+    for (t = s; *t; t++)
+	if ((unsigned char) *t >= 0x80 && !itok(*t))
+	    return NULL;
+    if (isset(CPRECEDENCES))
+	flags |= 1;
+    if (isset(OCTALZEROES))
+	flags |= 2;
+    if (isset(FORCEFLOAT))
+	flags |= 4;
+    if (EMULATION(EMULATE_SH))
+	flags |= 8;
+    if (isset(POSIXIDENTIFIERS))
+	flags |= 16;
+    key = zhalloc(t - s + 2);
+    key[0] = '@' + flags;
+    strcpy(key + 1, s);
+    return key;
+}
+
+/* Add an operation to the expression being compiled */
+
+static struct mathop *
+mathemit(int code)
+{
+    struct mathop *o;
+
+    if (mrec->nops == mrec->size) {
+	int osize = mrec->size;
+	mrec->size = osize ? 2 * osize : 32;
+	mrec->ops = zrealloc(mrec->ops, mrec->size * sizeof(struct mathop));
+	memset(mrec->ops + osize, 0,
+	       (mrec->size - osize) * sizeof(struct mathop));
+    }
+    o = mrec->ops + mrec->nops++;
+    o->code = code;
+    switch (code) {
+    case MO_OPBEGIN:
+    case MO_QCOND:
+	if (++mrec->depth > mrec->maxdepth)
+	    mrec->maxdepth = mrec->depth;
+	break;
+    case MO_OPEND:
+    case MO_QEND:
+	mrec->depth--;
+	break;
+    }
+    return o;
+}
+
+static void
+mathemitstr(int code, char *str)
+{
+    mathemit(code)->u.str = ztrdup(str);
+}
+
+/* Free an expression whose compilation was abandoned */
+
+static void
+freemathrec(struct mathrec *rec)
+{
+    int i;
+
+    for (i = 0; i < rec->nops; i++)
+	if (rec->ops[i].code == MO_ID || rec->ops[i].code == MO_CID ||
+	    rec->ops[i].code == MO_FUNC)
+	    zsfree(rec->ops[i].u.str);
+    zfree(rec->ops, rec->size * sizeof(struct mathop));
+}
+
+/* Keep a compiled expression */
+
+static void
+addmathprog(char *key, struct mathrec *rec, int end)
+{
+    Mathprog prog;
+
+    if (mathcache->ct >= MATHCACHE_MAX) {
+	if (mathrunning) {
+	    freemathrec(rec);
+	    return;
+	}
+	mathcache->emptytable(mathcache);
+    }
+    prog = (Mathprog) zshcalloc(sizeof(*prog));
+    prog->nops = rec->nops;
+    prog->ops = zrealloc(rec->ops, rec->nops * sizeof(struct mathop));
+    prog->ctldepth = rec->maxdepth;
+    prog->end = end;
+    mathcache->addnode(mathcache, ztrdup(key), prog);
+}
+
 /*
  * Get a number from a variable.
  * Try to be clever about reusing subscripts by caching the Value structure.
@@ -372,6 +583,9 @@ mathevall(char *s, enum prec_type prec_tp, char **ep)
     char *xyylval;
     int xsp;
     struct mathvalue *xstack = 0, nstack[STACKSZ];
+    struct mathrec rec, *xmrec = mrec;
+    Mathprog prog = NULL;
+    char *key = NULL;
     mnumber ret;
 
     if (mlevel >= MAX_MLEVEL) {
@@ -410,7 +624,29 @@ mathevall(char *s, enum prec_type prec_tp, char **ep)
     unary = 1;
     stack[0].val.type = MN_INTEGER;
     stack[0].val.u.l = 0;
-    mathparse(prec_tp == MPREC_TOP ? TOPPREC : ARGPREC);
+    mrec = NULL;
+    if (prec_tp == MPREC_TOP && (key = mathcachekey(s))) {
+	if (!mathcache)
+	    mathcache = newmathcache();
+	if (!(prog = (Mathprog) mathcache->getnode(mathcache, key))) {
+	    memset(&rec, 0, sizeof(rec));
+	    mrec = &rec;
+	}
+    }
+    if (prog) {
+	if (!errflag)
+	    runmathprog(prog);
+	mtok = EOI;
+	ptr = s + prog->end;
+    } else
+	mathparse(prec_tp == MPREC_TOP ? TOPPREC : ARGPREC);
+    if (mrec) {
+	if (!errflag && !rec.nocache && mtok == EOI)
+	    addmathprog(key, &rec, ptr - s);
+	else
+	    freemathrec(&rec);
+    }
+    mrec = xmrec;
     /*
      * Internally, we parse the contents of parentheses at top
      * precedence... so we can return a parenthesis here if
@@ -767,10 +1003,14 @@ zzlex(void)
 	    }
 	    return EQ;
 	case '$':
+	    if (mrec)
+		mrec->nocache = 1;
 	    yyval.u.l = mypid;
 	    return NUM;
 	case '?':
 	    if (unary) {
+		if (mrec)
+		    mrec->nocache = 1;
 		yyval.u.l = lastval;
 		return NUM;
 	    }
@@ -784,7 +1024,7 @@ zzlex(void)
 	    return EOI;
 	case '[':
 	    {
-		int n, checkradix = 0;
+		int n, checkradix = 0, checkus = 0;
 
 		if (idigit(*ptr)) {
 		    n = zstrtol(ptr, &ptr, 10);
@@ -808,6 +1048,7 @@ zzlex(void)
 			checkradix = 1;
 		    }
 		    if (*ptr == '_') {
+			checkus = 1;
 			ptr++;
 			if (idigit(*ptr))
 			    outputunderscore = zstrtol(ptr, &ptr, 10);
@@ -829,6 +1070,12 @@ zzlex(void)
 			return EOI;
 		    }
 		}
+		if (mrec) {
+		    struct mathop *o = mathemit(MO_RADIX);
+		    o->arg = checkradix | (checkus << 1);
+		    o->u.radix[0] = outputradix;
+		    o->u.radix[1] = outputunderscore;
+		}
 		ptr++;
 		break;
 	    }
@@ -848,6 +1095,8 @@ zzlex(void)
 		    int v;
 		    char *optr = ptr;
 
+		    if (mrec)
+			mrec->nocache = 1;
 		    ptr++;
 		    if (!*ptr) {
 			zerr("bad math expression: character missing after ##");
@@ -904,6 +1153,8 @@ zzlex(void)
 		return (func ? FUNC : (cct ? CID : ID));
 	    }
 	    else if (cct) {
+		if (mrec)
+		    mrec->nocache = 1;
 		yyval.u.l = poundgetfn(NULL);
 		return NUM;
 	    }
@@ -1475,6 +1726,91 @@ bop(int tk)
 }
 
 
+/* Name of a variable or function for use while running a program */
+
+static char *
+mathopname(struct mathop *o)
+{
+    /* Subscripts may be modified when they are parsed */
+    return strchr(o->u.str, '[') ? dupstring(o->u.str) : o->u.str;
+}
+
+/*
+ * Run a compiled expression, with the same effect as mathparse() would
+ * have on the string it was compiled from.
+ */
+
+static void
+runmathprog(Mathprog prog)
+{
+    struct mathop *o, *end = prog->ops + prog->nops;
+    int depth = 0, onoeval = noeval;
+    char *name;
+    zlong q;
+    VARARR(int, ctl, prog->ctldepth + 1);
+
+    mathrunning++;
+    queue_signals();
+    for (o = prog->ops; o < end && !errflag; o++) {
+	switch (o->code) {
+	case MO_NUM:
+	    lastbase = o->arg;
+	    push(o->u.num, NULL, 0);
+	    break;
+	case MO_ID:
+	    push(zero_mnumber, mathopname(o), !noeval);
+	    break;
+	case MO_CID:
+	    name = mathopname(o);
+	    push((noeval ? zero_mnumber : getcvar(name)), name, 0);
+	    break;
+	case MO_FUNC:
+	    name = mathopname(o);
+	    push((noeval ? zero_mnumber : callmathfunc(name)), name, 0);
+	    break;
+	case MO_OPBEGIN:
+	    ctl[depth++] = noeval;
+	    if (MTYPE(type[o->arg]) == BOOL)
+		bop(o->arg);
+	    break;
+	case MO_OPEND:
+	    noeval = ctl[--depth];
+	    op(o->arg);
+	    break;
+	case MO_QCOND:
+	    if (stack[sp].val.type == MN_UNSET)
+		stack[sp].val = getmathparam(stack + sp);
+	    q = (stack[sp].val.type == MN_FLOAT) ?
+		(stack[sp].val.u.d == 0 ? 0 : 1) :
+		stack[sp].val.u.l;
+	    ctl[depth++] = (q != 0);
+	    if (!q)
+		noeval++;
+	    break;
+	case MO_QELSE:
+	    if (ctl[depth - 1])
+		noeval++;
+	    else
+		noeval--;
+	    break;
+	case MO_QEND:
+	    if (ctl[--depth])
+		noeval--;
+	    op(QUEST);
+	    break;
+	case MO_RADIX:
+	    if (o->arg & 1)
+		outputradix = o->u.radix[0];
+	    if (o->arg & 2)
+		outputunderscore = o->u.radix[1];
+	    break;
+	}
+    }
+    noeval = onoeval;
+    unqueue_signals();
+    mathrunning--;
+}
+
 /**/
 mod_export mnumber
 matheval(char *s)
@@ -1603,15 +1939,26 @@ mathparse(int pc)
 	}
 	switch (mtok) {
 	case NUM:
+	    if (mrec) {
+		struct mathop *o = mathemit(MO_NUM);
+		o->arg = lastbase;
+		o->u.num = yyval;
+	    }
 	    push(yyval, NULL, 0);
 	    break;
 	case ID:
+	    if (mrec)
+		mathemitstr(MO_ID, yylval);
 	    push(zero_mnumber, yylval, !noeval);
 	    break;
 	case CID:
+	    if (mrec)
+		mathemitstr(MO_CID, yylval);
 	    push((noeval ? zero_mnumber : getcvar(yylval)), yylval, 0);
 	    break;
 	case FUNC:
+	    if (mrec)
+		mathemitstr(MO_FUNC, yylval);
 	    push((noeval ? zero_mnumber : callmathfunc(yylval)), yylval, 0);
 	    break;
 	case M_INPAR:
@@ -1624,6 +1971,8 @@ mathparse(int pc)
 	    }
 	    break;
 	case QUEST:
+	    if (mrec)
+		mathemit(MO_QCOND);
 	    if (stack[sp].val.type == MN_UNSET)
 		stack[sp].val = getmathparam(stack + sp);
 	    q = (stack[sp].val.type == MN_FLOAT) ?
@@ -1641,20 +1990,28 @@ mathparse(int pc)
 		unqueue_signals();
 		return;
 	    }
+	    if (mrec)
+		mathemit(MO_QELSE);
 	    if (q)
 		noeval++;
 	    mathparse(prec[QUEST]);
 	    if (q)
 		noeval--;
+	    if (mrec)
+		mathemit(MO_QEND);
 	    op(QUEST);
 	    continue;
 	default:
 	    otok = mtok;
 	    onoeval = noeval;
+	    if (mrec)
+		mathemit(MO_OPBEGIN)->arg = otok;
 	    if (MTYPE(type[otok]) == BOOL)
 		bop(otok);
 	    mathparse(prec[otok] - (MTYPE(type[otok]) != RL));
 	    noeval = onoeval;
+	    if (mrec)
+		mathemit(MO_OPEND)->arg = otok;
 	    op(otok);
 	    continue;
 	}
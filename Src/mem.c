@@ -124,6 +124,12 @@ union mem_align {
 /* Memory available for user data in heap h */
 #define ARENA_SIZEOF(h) ((h)->size - sizeof(struct heap))
 
+/* Largest arena allocated just to extend a heap, see zhalloc(). */
+#define HEAP_MAX_ARENA (8 * HEAPSIZE)
+
+/* Number of empty arenas of the standard size kept for reuse. */
+#define HEAP_FREE_ARENAS 8
+
 /* list of zsh heaps */
 
 static Heap heaps;
@@ -133,6 +139,24 @@ static Heap heaps;
 
 static Heap fheap;
 
+/*
+ * Empty arenas kept for reuse.  Every command pushes and pops the
+ * heap, so one that needs a fresh arena would otherwise get it from
+ * the system and give it back each time.
+ */
+
+static Heap free_arenas;
+static int nfree_arenas;
+
+/* Real size of an arena allocated for HEAPSIZE bytes; 0 if none yet */
+
+static size_t std_arena_size;
+
+/* Counters for the memstats builtin in the zsh/memstats module */
+
+/**/
+mod_export struct heapstats heapstats;
+
 /**/
 #ifdef ZSH_HEAP_DEBUG
 /*
@@ -231,14 +255,7 @@ old_heaps(Heap old)
 		    "freed in old_heaps().\n", h->heap_id);
 	}
 #endif
-#ifdef USE_MMAP
-	munmap((void *) h, h->size);
-#else
-	zfree(h, HEAPSIZE);
-#endif
-#ifdef ZSH_VALGRIND
-	VALGRIND_DESTROY_MEMPOOL((char *)h);
-#endif
+	free_arena(h);
     }
     heaps = old;
 #ifdef ZSH_HEAP_DEBUG
@@ -418,14 +435,7 @@ freeheap(void)
 		fheap = hl = h;
 		break;
 	    }
-#ifdef USE_MMAP
-	    munmap((void *) h, h->size);
-#else
-	    zfree(h, HEAPSIZE);
-#endif
-#ifdef ZSH_VALGRIND
-	    VALGRIND_DESTROY_MEMPOOL((char *)h);
-#endif
+	    free_arena(h);
 	}
     }
     if (hl)
@@ -499,14 +509,7 @@ popheap(void)
 		h->next = NULL;
 	    } else if (hl == h)	/* This is the last arena of all */
 		hl = NULL;
-#ifdef USE_MMAP
-	    munmap((void *) h, h->size);
-#else
-	    zfree(h, HEAPSIZE);
-#endif
-#ifdef ZSH_VALGRIND
-	    VALGRIND_DESTROY_MEMPOOL((char *)h);
-#endif
+	    free_arena(h);
 	}
     }
     if (hl)
@@ -554,6 +557,64 @@ mmap_heap_alloc(size_t *n)
 }
 #endif
 
+/*
+ * Get an arena with room for n bytes including the header, from the
+ * free list if one there is big enough.  h->size is set to the real
+ * size, which may be larger than n.
+ */
+
+/**/
+static Heap
+alloc_arena(size_t n)
+{
+    Heap h, *hp;
+    size_t req = n;
+
+    for (hp = &free_arenas; (h = *hp); hp = &h->next)
+	if (h->size >= n) {
+	    *hp = h->next;
+	    nfree_arenas--;
+	    heapstats.reused++;
+	    return h;
+	}
+#ifdef USE_MMAP
+    h = mmap_heap_alloc(&n);
+#else
+    h = (Heap) zalloc(n);
+#endif
+    h->size = n;
+    if (req == HEAPSIZE)
+	std_arena_size = n;
+    heapstats.arenas++;
+    if ((heapstats.bytes += n) > heapstats.peak)
+	heapstats.peak = heapstats.bytes;
+    return h;
+}
+
+/* Finish with an arena, keeping it for reuse if it's of the standard size. */
+
+/**/
+static void
+free_arena(Heap h)
+{
+#ifdef ZSH_VALGRIND
+    VALGRIND_DESTROY_MEMPOOL((char *)h);
+#endif
+    if (nfree_arenas < HEAP_FREE_ARENAS && h->size == std_arena_size) {
+	h->next = free_arenas;
+	free_arenas = h;
+	nfree_arenas++;
+	return;
+    }
+    heapstats.freed++;
+    heapstats.bytes -= h->size;
+#ifdef USE_MMAP
+    munmap((void *) h, h->size);
+#else
+    zfree(h, h->size);
+#endif
+}
+
 /* check whether a pointer is within a memory pool */
 
 /**/
@@ -631,13 +692,18 @@ zhalloc(size_t size)
             /* tricky, see above */
 #endif
 
-	n = HEAP_ARENA_SIZE > size ? HEAPSIZE : size + sizeof(*h);
+	/*
+	 * An arena added to a heap already in use is twice the size
+	 * of the last one, up to HEAP_MAX_ARENA, so that a large
+	 * expansion doesn't need many small arenas.
+	 */
+	n = hp ? 2 * hp->size : HEAPSIZE;
+	if (n > HEAP_MAX_ARENA)
+	    n = HEAP_MAX_ARENA;
+	if (n < size + sizeof(*h))
+	    n = size + sizeof(*h);
 
-#ifdef USE_MMAP
-	h = mmap_heap_alloc(&n);
-#else
-	h = (Heap) zalloc(n);
-#endif
+	h = alloc_arena(n);
 
 #if defined(ZSH_MEM) && !defined(USE_MMAP)
 	if (called)
@@ -645,7 +711,6 @@ zhalloc(size_t size)
 	called = 1;
 #endif
 
-	h->size = n;
 	h->used = size;
 	h->next = NULL;
 	h->sp = NULL;
@@ -658,8 +723,7 @@ zhalloc(size_t size)
 #endif
 #ifdef ZSH_VALGRIND
 	VALGRIND_CREATE_MEMPOOL((char *)h, 0, 0);
-	VALGRIND_MAKE_MEM_NOACCESS((char *)arena(h),
-				   n - ((char *)arena(h)-(char *)h));
+	VALGRIND_MAKE_MEM_NOACCESS((char *)arena(h), ARENA_SIZEOF(h));
 	VALGRIND_MEMPOOL_ALLOC((char *)h, (char *)arena(h), req_size);
 #endif
 
@@ -730,6 +794,7 @@ hrealloc(char *p, size_t old, size_t new)
 #else
 	    char *ptr = (char *) zhalloc(new);
 #endif
+	    heapstats.copies++;
 	    memcpy(ptr, p, old);
 #ifdef ZSH_MEM_DEBUG
 	    memset(p, 0xff, old);
@@ -781,14 +846,7 @@ hrealloc(char *p, size_t old, size_t new)
 	    else
 		heaps = h->next;
 	    fheap = NULL;
-#ifdef USE_MMAP
-	    munmap((void *) h, h->size);
-#else
-	    zfree(h, HEAPSIZE);
-#endif
-#ifdef ZSH_VALGRIND
-	    VALGRIND_DESTROY_MEMPOOL((char *)h);
-#endif
+	    free_arena(h);
 	    unqueue_signals();
 	    return NULL;
 	}
@@ -804,7 +862,7 @@ hrealloc(char *p, size_t old, size_t new)
 	     * point in this since we didn't consistently record
 	     * the allocated size of the heap, but now we do.)
 	     */
-	    size_t n = (new + sizeof(*h) + HEAPSIZE);
+	    size_t n = (new + sizeof(*h) + HEAPSIZE), osize = h->size;
 	    n -= n % HEAPSIZE;
 	    fheap = NULL;
 
@@ -819,10 +877,13 @@ hrealloc(char *p, size_t old, size_t new)
 		/* Copy the entire heap, header (with next pointer) included */
 		memcpy(hnew, h, h->size);
 		munmap((void *)h, h->size);
+		heapstats.copies++;
 	    }
 #else
 	    hnew = (Heap) realloc(h, n);
 #endif
+	    if ((heapstats.bytes += n - osize) > heapstats.peak)
+		heapstats.peak = heapstats.bytes;
 #ifdef ZSH_VALGRIND
 	    VALGRIND_MEMPOOL_FREE((char *)h, p);
 	    VALGRIND_DESTROY_MEMPOOL((char *)h);
@@ -867,6 +928,7 @@ hrealloc(char *p, size_t old, size_t new)
 	return p;
     } else {
 	char *t = zhalloc(new);
+	heapstats.copies++;
 	memcpy(t, p, old > new ? new : old);
 	h->used -= old;
 #ifdef ZSH_MEM_DEBUG
@@ -1022,6 +1084,99 @@ zrealloc(void *ptr, size_t size)
     return ptr;
 }
 
+/*
+ * Allocation of small objects of fixed size: linked list nodes,
+ * parameters, hash table entries and the like.  These are created and
+ * destroyed in large numbers, so freed blocks are kept on a list for
+ * each size class and handed out again by slaballoc() instead of going
+ * back to malloc().  The blocks are still ordinary malloc() blocks, so
+ * one may safely be released with zfree() instead of slabfree(); and a
+ * block from zalloc() may be given to slabfree() as long as the size is
+ * not larger than the one allocated.
+ */
+
+#ifdef ZSH_SLAB
+
+/*
+ * Sizes are rounded to a multiple of this; structures normally have
+ * a size that is already a multiple of it, so they round exactly.
+ */
+#define SLAB_ALIGN   sizeof(void *)
+/* Largest object kept */
+#define SLAB_MAX     256
+/* Most free blocks kept for each size */
+#define SLAB_KEEP    1024
+
+struct slabblk {
+    struct slabblk *next;
+};
+
+static struct slabblk *slabs[SLAB_MAX / SLAB_ALIGN + 1];
+static int nslabs[SLAB_MAX / SLAB_ALIGN + 1];
+
+#endif
+
+/**/
+mod_export void *
+slaballoc(size_t size)
+{
+#ifdef ZSH_SLAB
+    size_t n = (size + SLAB_ALIGN - 1) / SLAB_ALIGN;
+    struct slabblk *b;
+
+    if (n && n <= SLAB_MAX / SLAB_ALIGN) {
+	queue_signals();
+	if ((b = slabs[n])) {
+	    slabs[n] = b->next;
+	    nslabs[n]--;
+	    heapstats.slabreused++;
+	    heapstats.slabcached--;
+	    unqueue_signals();
+	    return (void *) b;
+	}
+	heapstats.slabnew++;
+	unqueue_signals();
+	return zalloc(n * SLAB_ALIGN);
+    }
+#endif
+    return zalloc(size);
+}
+
+/**/
+mod_export void *
+slabcalloc(size_t size)
+{
+    void *ptr = slaballoc(size);
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+/**/
+mod_export void
+slabfree(void *p, size_t size)
+{
+#ifdef ZSH_SLAB
+    /*
+     * Round down: the block may have come from zalloc() rather than
+     * slaballoc(), in which case it is no bigger than size.
+     */
+    size_t n = size / SLAB_ALIGN;
+
+    if (p && n && n <= SLAB_MAX / SLAB_ALIGN && nslabs[n] < SLAB_KEEP) {
+	struct slabblk *b = (struct slabblk *) p;
+
+	queue_signals();
+	b->next = slabs[n];
+	slabs[n] = b;
+	nslabs[n]++;
+	heapstats.slabcached++;
+	unqueue_signals();
+	return;
+    }
+#endif
+    zfree(p, size);
+}
+
 /**/
 #ifdef ZSH_MEM
 
@@ -1311,6 +1466,8 @@ malloc(size_t size)
 	else
 	    heaps = hf->next;
 	/* now we simply free it and than search the free list again */
+	heapstats.freed++;
+	heapstats.bytes -= hf->size;
 	zfree(hf, HEAPSIZE);
 
 	for (mp = NULL, m = m_free; m && m->len < size; mp = m, m = m->next);
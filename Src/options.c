@@ -118,6 +118,7 @@ static struct optname optns[] = {
 {{NULL, "clobberempty",	      0},			 CLOBBEREMPTY},
 {{NULL, "combiningchars",     0},			 COMBININGCHARS},
 {{NULL, "completealiases",    0},			 COMPLETEALIASES},
+{{NULL, "completecanceloninput", 0},			 COMPLETECANCELONINPUT},
 {{NULL, "completeinword",     0},			 COMPLETEINWORD},
 {{NULL, "continueonerror",    0},                        CONTINUEONERROR},
 {{NULL, "correct",	      0},			 CORRECT},
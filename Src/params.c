@@ -53,6 +53,11 @@
 /**/
 mod_export int locallevel;
 
+/* Incremented whenever the environment passed to commands changes. */
+
+/**/
+int environgen;
+
 /* Variables holding values of special parameters */
  
 /**/
@@ -663,9 +668,19 @@ scanparamvals(HashNode hn, int flags)
 char **
 paramvalarr(HashTable ht, int flags)
 {
+    int nkeys;
+
     DPUTS((flags & (SCANPM_MATCHKEY|SCANPM_MATCHVAL)) && !scanprog,
 	  "BUG: scanning hash without scanprog set");
     numparamvals = 0;
+    /* Plain lists of keys are cached with the table. */
+    if (ht && ht != realparamtab &&
+	(flags & (SCANPM_WANTKEYS|SCANPM_WANTVALS|SCANPM_MATCHKEY|
+		  SCANPM_MATCHVAL|SCANPM_KEYMATCH)) == SCANPM_WANTKEYS &&
+	(paramvals = hashtablekeys(ht, PM_UNSET, &nkeys))) {
+	numparamvals = nkeys;
+	return paramvals;
+    }
     if (ht)
 	scanhashtable(ht, 0, 0, PM_UNSET, scancountparams, flags);
     paramvals = (char **) zhalloc((numparamvals + 1) * sizeof(char *));
@@ -698,6 +713,34 @@ getvaluearr(Value v)
 	return NULL;
 }
 
+/*
+ * Return the length of arr, which is the value of the array parameter
+ * pm, if it is known without counting, else -1.  Only plain arrays
+ * keep track of their length; the storage of a tied array can be
+ * replaced through the scalar it is tied to.
+ */
+
+/**/
+mod_export int
+knownarrlen(Param pm, char **arr)
+{
+    if (!pm || !pm->asize || (pm->node.flags & PM_TIED) ||
+	PM_TYPE(pm->node.flags) != PM_ARRAY || pm->gsu.a->setfn != arrsetfn)
+	return -1;
+    return arr == pm->u.arr ? pm->alen : -1;
+}
+
+/* Return the length of arr, the value of the array parameter pm. */
+
+/**/
+mod_export int
+arrparamlen(Param pm, char **arr)
+{
+    int len = knownarrlen(pm, arr);
+
+    return len >= 0 ? len : arrlen(arr);
+}
+
 /* Return whether the variable is set         *
  * checks that array slices are within range  *
  * used for [[ -v ... ]] condition test       */
@@ -1067,7 +1110,7 @@ createparam(char *name, int flags)
 	    pm->base = pm->width = 0;
 	    oldpm = pm->old;
 	} else {
-	    pm = (Param) zshcalloc(sizeof *pm);
+	    pm = (Param) slabcalloc(sizeof *pm);
 	    if ((pm->old = oldpm)) {
 		/*
 		 * needed to avoid freeing oldpm, but we do take it
@@ -1271,6 +1314,151 @@ isident(char *s)
     return !ss[1];
 }
 
+/*
+ * Index of the characters in the value of one scalar parameter, so
+ * that subscripting a long string in a loop doesn't need to decode it
+ * from the start each time.  It's built the first time a character
+ * position in the value is looked up and forgotten when the value
+ * changes; see forgetcharindex().
+ */
+
+#define CHARINDEX_MIN	256	/* don't bother for shorter values */
+#define CHARINDEX_STEP	64	/* characters between samples */
+
+static struct charindex {
+    Param pm;		/* parameter described, or NULL */
+    char *str;		/* its value when the index was made */
+    int mb;		/* MULTIBYTE was set */
+    int ascii;		/* value is all single-byte characters */
+    int nbytes;		/* length of value in bytes */
+    int nchars;		/* length of value in characters */
+    int *offs;		/* byte offset of each CHARINDEX_STEP'th character */
+} charindex;
+
+/*
+ * Forget the character index if it describes pm, or whatever it
+ * describes if pm is NULL.  This must be called whenever the string
+ * value of a parameter may have changed in place or been freed.
+ */
+
+/**/
+void
+forgetcharindex(Param pm)
+{
+    if (charindex.pm && (!pm || charindex.pm == pm)) {
+	if (charindex.offs)
+	    zfree(charindex.offs, (charindex.nchars / CHARINDEX_STEP + 1) *
+		  sizeof(int));
+	charindex.offs = NULL;
+	charindex.pm = NULL;
+    }
+}
+
+/*
+ * Return 1 if the character index is usable for s, the value of pm,
+ * making it if need be.
+ */
+
+/**/
+static int
+getcharindex(Param pm, char *s)
+{
+    char *t;
+    int nchars, nbytes, i;
+
+    if (charindex.pm == pm && charindex.str == s &&
+	charindex.mb == isset(MULTIBYTE))
+	return 1;
+    if (!pm || s != pm->u.str || pm->gsu.s != &stdscalar_gsu ||
+	(pm->node.flags & (PM_SPECIAL|PM_NAMEREF)) ||
+	pm->node.nam == nulstring ||
+	(nbytes = strlen(s)) < CHARINDEX_MIN)
+	return 0;
+
+    forgetcharindex(NULL);
+    charindex.pm = pm;
+    charindex.str = s;
+    charindex.mb = isset(MULTIBYTE);
+    charindex.nbytes = nbytes;
+    for (t = s; *t && !(*t & 0x80); t++)
+	;
+    if (!*t) {
+	/* Meta is not ASCII, so this is one byte per character */
+	charindex.ascii = 1;
+	charindex.nchars = nbytes;
+	return 1;
+    }
+    charindex.ascii = 0;
+    charindex.nchars = nchars = MB_METASTRLEN(s);
+    charindex.offs = (int *) zalloc((nchars / CHARINDEX_STEP + 1) *
+				    sizeof(int));
+    MB_METACHARINIT();
+    for (t = s, i = 0; i < nchars; i++) {
+	if (!(i % CHARINDEX_STEP))
+	    charindex.offs[i / CHARINDEX_STEP] = t - s;
+	t += MB_METACHARLEN(t);
+    }
+    if (!(nchars % CHARINDEX_STEP))
+	charindex.offs[nchars / CHARINDEX_STEP] = t - s;
+    return 1;
+}
+
+/*
+ * Move forward *ncharsp characters from s, the value of pm, stopping
+ * at the end of the string.  *ncharsp is reduced by the number of
+ * characters moved; if any were, *lastcharlen is set to the length of
+ * the last of them.
+ */
+
+/**/
+static char *
+skipchars(Param pm, char *s, zlong *ncharsp, int *lastcharlen)
+{
+    zlong nchars = *ncharsp;
+    char *t;
+
+    if (!nchars)
+	return s;
+    if (getcharindex(pm, s)) {
+	zlong base;
+
+	if (charindex.ascii) {
+	    base = (nchars < charindex.nchars) ? nchars : charindex.nchars;
+	    *ncharsp = nchars - base;
+	    *lastcharlen = 1;
+	    return s + base;
+	}
+	if (nchars > charindex.nchars)
+	    base = charindex.nchars;
+	else
+	    base = nchars;
+	/* walk at least one character to find its length */
+	base = (base - 1) / CHARINDEX_STEP;
+	t = s + charindex.offs[base];
+	nchars -= base * CHARINDEX_STEP;
+    } else
+	t = s;
+    MB_METACHARINIT();
+    for (; nchars && *t; nchars--)
+	t += (*lastcharlen = MB_METACHARLEN(t));
+    *ncharsp = nchars;
+    return t;
+}
+
+/*
+ * Return the length in bytes of s, the value of pm, using the
+ * character index if that describes it.
+ */
+
+/**/
+static int
+valuestrlen(Param pm, char *s)
+{
+    if (charindex.pm && charindex.pm == pm && charindex.str == s)
+	return charindex.nbytes;
+    return strlen(s);
+}
+
 /*
  * Parse a single argument to a parameter subscript.
  * The subscripts starts at *str; *str is updated (input/output)
@@ -1564,9 +1752,7 @@ getarg(char **str, int *inv, Value v, int a2, zlong *w,
 	    if (r > 0) {
 		zlong nchars = r;
 
-		MB_METACHARINIT();
-		for (t = s; nchars && *t; nchars--)
-		    t += (lastcharlen = MB_METACHARLEN(t));
+		t = skipchars(v->pm, s, &nchars, &lastcharlen);
 		/* for consistency, keep any remainder off the end */
 		r = (zlong)(t - s) + nchars;
 		if (prevcharlen && !nchars /* ignore if off the end */)
@@ -1581,16 +1767,15 @@ getarg(char **str, int *inv, Value v, int a2, zlong *w,
 		    *nextcharlen = MB_METACHARLEN(s);
 		}
 	    } else {
-		zlong nchars = (zlong)MB_METASTRLEN(s) + r;
+		zlong nchars = (getcharindex(v->pm, s) ? charindex.nchars :
+				(zlong)MB_METASTRLEN(s)) + r;
 
 		if (nchars < 0) {
 		    /* make sure this isn't valid as a raw pointer */
-		    r -= (zlong)strlen(s);
+		    r -= (zlong)valuestrlen(v->pm, s);
 		} else {
-		    MB_METACHARINIT();
-		    for (t = s; nchars && *t; nchars--)
-			t += (lastcharlen = MB_METACHARLEN(t));
-		    r = - (zlong)strlen(t); /* keep negative */
+		    t = skipchars(v->pm, s, &nchars, &lastcharlen);
+		    r = - (zlong)(valuestrlen(v->pm, s) - (t - s)); /* keep negative */
 		    if (prevcharlen)
 			*prevcharlen = lastcharlen;
 		    if (nextcharlen && *t)
@@ -2293,9 +2478,11 @@ getstrvalue(Value v)
 	if (v->isarr)
 	    s = sepjoin(ss, NULL, 1);
 	else {
+	    int len = knownarrlen(v->pm, ss);
 	    if (v->start < 0)
-		v->start += arrlen(ss);
-	    s = (arrlen_le(ss, v->start) || v->start < 0) ?
+		v->start += len >= 0 ? len : arrlen(ss);
+	    s = (v->start < 0 ||
+		 (len >= 0 ? len <= v->start : arrlen_le(ss, v->start))) ?
 		(char *) hcalloc(1) : ss[v->start];
 	}
 	return s;
@@ -2445,7 +2632,7 @@ getstrvalue(Value v)
     if (v->start == 0 && v->end == -1)
 	return s;
 
-    len = strlen(s);
+    len = valuestrlen(v->pm, s);
     if (v->start < 0) {
 	v->start += len;
 	if (v->start < 0)
@@ -2460,13 +2647,11 @@ getstrvalue(Value v)
 	}
     }
 
-    s = (v->start > len) ? dupstring("") :
-	dupstring_wlen(s + v->start, len - v->start);
-
-    if (v->end <= v->start)
-	s[0] = '\0';
-    else if (v->end - v->start <= len - v->start)
-	s[v->end - v->start] = '\0';
+    if (v->start > len || v->end <= v->start)
+	s = dupstring("");
+    else
+	s = dupstring_wlen(s + v->start,
+			   (v->end < len ? v->end : len) - v->start);
 
     return s;
 }
@@ -2494,10 +2679,13 @@ getarrvalue(Value v)
     s = getvaluearr(v);
     if (v->start == 0 && v->end == -1)
 	return s;
-    if (v->start < 0)
-	v->start += arrlen(s);
-    if (v->end < 0)
-	v->end += arrlen(s) + 1;
+    if (v->start < 0 || v->end < 0) {
+	int len = arrparamlen(v->pm, s);
+	if (v->start < 0)
+	    v->start += len;
+	if (v->end < 0)
+	    v->end += len + 1;
+    }
 
     /* Null if 1) array too short, 2) index still negative */
     if (v->end <= v->start) {
@@ -2703,6 +2891,7 @@ assignstrvalue(Value v, char *val, int flags)
 		Param pm = v->pm;
                 /* Size doesn't change, can limit actions to only
                  * overwriting bytes in already allocated string */
+		forgetcharindex(pm);
 		memcpy(z + v->start, val, vlen);
 		/* Implement remainder of strsetfn */
 		if (!(pm->node.flags & PM_HASHELEM) &&
@@ -2868,7 +3057,7 @@ setarrvalue(Value v, char **val)
 	char **const old = v->pm->gsu.a->getfn(v->pm);
 	char **new;
 	char **p, **q, **r; /* index variables */
-	const int pre_assignment_length = arrlen(old);
+	const int pre_assignment_length = arrparamlen(v->pm, old);
 	int post_assignment_length;
 	int i;
 
@@ -2923,8 +3112,21 @@ setarrvalue(Value v, char **val)
                     pre_assignment_length > 0 &&
                     v->pm->gsu.a->setfn == arrsetfn)
             {
-                p = new = (char **) zrealloc(old, sizeof(char *)
-                                           * (post_assignment_length + 1));
+                /*
+                 * Grow the allocation geometrically so that repeated
+                 * appends don't reallocate and copy every time.
+                 */
+                int size = knownarrlen(v->pm, old) >= 0 ?
+                    v->pm->asize : pre_assignment_length + 1;
+
+                if (post_assignment_length + 1 > size) {
+                    size *= 2;
+                    if (size < post_assignment_length + 1)
+                        size = post_assignment_length + 1;
+                    new = (char **) zrealloc(old, sizeof(char *) * size);
+                } else
+                    new = old;
+                p = new;
 
                 p += pre_assignment_length; /* after old elements */
 
@@ -2948,6 +3150,10 @@ setarrvalue(Value v, char **val)
 
                 v->pm->u.arr = NULL;
                 v->pm->gsu.a->setfn(v->pm, new);
+                if (!(v->pm->node.flags & PM_UNIQUE) && v->pm->u.arr == new) {
+                    v->pm->alen = post_assignment_length;
+                    v->pm->asize = size;
+                }
             } else {
                 p = new = (char **) zalloc(sizeof(char *)
                                            * (post_assignment_length + 1));
@@ -3490,7 +3696,7 @@ assignaparam(char *s, char **val, int flags)
     if (flags & ASSPM_AUGMENT) {
     	if (v->start == 0 && v->end == -1) {
 	    if (PM_TYPE(v->pm->node.flags) & PM_ARRAY) {
-	    	v->start = arrlen(v->pm->gsu.a->getfn(v->pm));
+	    	v->start = arrparamlen(v->pm, v->pm->gsu.a->getfn(v->pm));
 	    	v->end = v->start + 1;
 	    } else if (PM_TYPE(v->pm->node.flags) & PM_HASHED)
 	    	v->start = -1, v->end = 0;
@@ -3498,7 +3704,8 @@ assignaparam(char *s, char **val, int flags)
 	    if (v->end > 0)
 		v->start = v->end--;
 	    else if (PM_TYPE(v->pm->node.flags) & PM_ARRAY) {
-		v->end = arrlen(v->pm->gsu.a->getfn(v->pm)) + v->end;
+		v->end = arrparamlen(v->pm, v->pm->gsu.a->getfn(v->pm)) +
+		    v->end;
 		v->start = v->end + 1;
 	    }
 	}
@@ -3787,7 +3994,7 @@ unsetparam_pm(Param pm, int altflag, int exp)
 
 	zsfree(altremove);
 	if (!(pm->node.flags & PM_SPECIAL))
-	    pm->gsu.s = &stdscalar_gsu;
+	    assigngetset(pm);
     }
 
     /*
@@ -3865,6 +4072,7 @@ stdunsetfn(Param pm, UNUSED(int exp))
 	    break;
 
 	default:
+	    forgetcharindex(pm);
 	    if (!(pm->node.flags & PM_SPECIAL))
 	    	pm->u.str = NULL;
 	    break;
@@ -3930,6 +4138,7 @@ strgetfn(Param pm)
 mod_export void
 strsetfn(Param pm, char *x)
 {
+    forgetcharindex(pm);
     zsfree(pm->u.str);
     pm->u.str = x;
     if (!(pm->node.flags & PM_HASHELEM) &&
@@ -3963,6 +4172,7 @@ arrsetfn(Param pm, char **x)
     if (pm->node.flags & PM_UNIQUE)
 	uniqarray(x);
     pm->u.arr = x;
+    pm->asize = 0;
     /* Arrays tied to colon-arrays may need to fix the environment */
     if (pm->ename && x)
 	arrfixenv(pm->ename, x);
@@ -4250,14 +4460,16 @@ void
 tiedarrsetfn(Param pm, char *x)
 {
     struct tieddata *dptr = (struct tieddata *)pm->u.data;
+    Param altpm = pm->ename ?
+	(Param) paramtab->getnode(paramtab, pm->ename) : NULL;
 
     if (*dptr->arrptr)
 	freearray(*dptr->arrptr);
-    else if (pm->ename) {
-	Param altpm = (Param) paramtab->getnode(paramtab, pm->ename);
-	if (altpm)
-	    altpm->node.flags &= ~PM_DEFAULTED;
-    }
+    else if (altpm)
+	altpm->node.flags &= ~PM_DEFAULTED;
+    /* The array's storage is replaced below, so its length changes */
+    if (altpm && &altpm->u.arr == dptr->arrptr)
+	altpm->asize = 0;
     if (x) {
 	char sepbuf[3];
 	if (imeta(dptr->joinchar))
@@ -4728,6 +4940,7 @@ clear_mbstate(void) {
     mb_charinit();	/* utils.c */
     clear_shiftstate();	/* pattern.c */
 #endif
+    forgetcharindex(NULL);
 }
 
 /**/
@@ -5220,6 +5433,7 @@ int
 zputenv(char *str)
 {
     DPUTS(!str, "Attempt to put null string into environment.");
+    environgen++;
 #ifdef USE_SET_UNSET_ENV
     /*
      * If we are using unsetenv() to remove values from the
@@ -5438,6 +5652,7 @@ delenvvalue(char *x)
 {
     char **ep;
 
+    environgen++;
     for (ep = environ; *ep; ep++) {
 	if (*ep == x)
 	    break;
@@ -5458,6 +5673,7 @@ void
 delenv(Param pm)
 {
 #ifdef USE_SET_UNSET_ENV
+    environgen++;
     unsetenv(pm->node.nam);
     zsfree(pm->env);
 #else
@@ -5859,6 +6075,7 @@ freeparamnode(HashNode hn)
 {
     Param pm = (Param) hn;
  
+    forgetcharindex(pm);
     /* The second argument of unsetfn() is used by modules to
      * differentiate "exp"licit unset from implicit unset, as when
      * a parameter is going out of scope.  It's not clear which
@@ -5870,7 +6087,7 @@ freeparamnode(HashNode hn)
     /* If this variable was tied by the user, ename was ztrdup'd */
     if (!(pm->node.flags & PM_SPECIAL))
 	zsfree(pm->ename);
-    zfree(pm, sizeof(struct param));
+    slabfree(pm, sizeof(struct param));
 }
 
 /* Print a parameter */
@@ -3814,6 +3814,124 @@ try_source_file(char *file)
     return NULL;
 }
 
+/*
+ * Automatic wordcode cache for autoloaded functions.  If
+ * $ZSH_WORDCODE_CACHE is set to an absolute directory name, a function
+ * loaded with aliases disabled from an absolute path <path> is compiled
+ * into <cache><path>.zwc.  The entry for the function in that file is
+ * named <dev>:<ino>:<mtime>:<size>/<name>, so the compiled version is
+ * only used as long as the source file is unchanged.
+ */
+
+/**/
+static char *
+wccache_file(char *file)
+{
+    char *dir;
+
+    if (*file != '/' || !noaliases ||
+	!(dir = getsparam("ZSH_WORDCODE_CACHE")) || *dir != '/')
+	return NULL;
+    dir = unmeta(dir);
+    return dyncat(dir, dyncat(file, FD_EXT));
+}
+
+/**/
+static char *
+wccache_key(struct stat *sn, char *name)
+{
+    char *key = (char *) zhalloc(5 * (DIGBUFSIZE + 1) + strlen(name) + 1);
+    unsigned long nsec = 0;
+
+#ifdef GET_ST_MTIME_NSEC
+    nsec = (unsigned long) GET_ST_MTIME_NSEC(*sn);
+#endif
+    sprintf(key, "%lx:%lx:%lx.%lx:%lx/%s", (unsigned long) sn->st_dev,
+	    (unsigned long) sn->st_ino, (unsigned long) sn->st_mtime, nsec,
+	    (unsigned long) sn->st_size, name);
+    return key;
+}
+
+/* Return the cached wordcode for the function `name' defined in the
+ * unmetafied `file' with status `sn', or NULL if there is none. */
+
+/**/
+Eprog
+try_wccache_file(char *file, char *name, struct stat *sn, int *ksh)
+{
+    Eprog prog = NULL;
+    Wordcode d;
+    FDHead h;
+    char *cfile;
+
+    if (!(cfile = wccache_file(file)))
+	return NULL;
+    queue_signals();
+    if ((d = load_dump_header(NULL, cfile, 0)) &&
+	(h = dump_find_func(d, name)) &&
+	!strcmp(fdname(h), wccache_key(sn, name)))
+	prog = check_dump_file(cfile, NULL, name, ksh, 0);
+    unqueue_signals();
+    return prog;
+}
+
+/* Store the wordcode for a function just parsed from `file' in the
+ * cache.  The file is written under a temporary name and renamed, so
+ * other shells never see it half written. */
+
+/**/
+void
+write_wccache_file(char *file, char *name, struct stat *sn, Eprog prog)
+{
+    LinkList progs;
+    WCFunc wcf;
+    char *cfile, *tmp, *p;
+    int dfd, hlen, tlen;
+
+    /*
+     * Don't trust a modification time from the current second:
+     * the file may yet change again without the time changing.
+     */
+    if (sn->st_mtime >= time(NULL) || !(cfile = wccache_file(file)))
+	return;
+    for (p = cfile + 1; (p = strchr(p, '/')); p++) {
+	*p = '\0';
+	if (mkdir(cfile, 0700) < 0 && errno != EEXIST) {
+	    *p = '/';
+	    return;
+	}
+	*p = '/';
+    }
+    tmp = (char *) zhalloc(strlen(cfile) + DIGBUFSIZE + 2);
+    sprintf(tmp, "%s.%ld", cfile, (long) getpid());
+
+    queue_signals();
+    unlink(tmp);
+    if ((dfd = open(tmp, O_WRONLY|O_CREAT|O_EXCL, 0444)) < 0) {
+	unqueue_signals();
+	return;
+    }
+    wcf = (WCFunc) zhalloc(sizeof(*wcf));
+    wcf->name = wccache_key(sn, name);
+    /* write_dump() byte-swaps the wordcode, so give it a copy. */
+    wcf->prog = dupeprog(prog, 1);
+    wcf->flags = 0;
+    progs = newlinklist();
+    addlinknode(progs, wcf);
+
+    hlen = FD_PRELEN + (sizeof(struct fdhead) / sizeof(wordcode)) +
+	(strlen(wcf->name) + sizeof(wordcode)) / sizeof(wordcode);
+    tlen = (prog->len - (prog->npats * sizeof(Patprog)) +
+	    sizeof(wordcode) - 1) / sizeof(wordcode);
+    tlen = (tlen + hlen) * sizeof(wordcode);
+
+    write_dump(dfd, progs, 1, hlen, tlen);
+
+    if (close(dfd) < 0 || rename(tmp, cfile) < 0)
+	unlink(tmp);
+    unqueue_signals();
+}
+
 /* See if `file' names a wordcode dump file and that contains the
  * definition for the function `name'. If so, return an eprog for it. */
 
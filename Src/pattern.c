@@ -510,6 +510,186 @@ patcompcharsset(void)
     }
 }
 
+/*
+ * Cache of compiled patterns.  The same pattern is often compiled
+ * again and again, for example in a loop over ${var#pat} or a
+ * zstyle lookup, so we keep the most recently used programmes.
+ *
+ * The key is made from the pattern text together with everything
+ * else that affects compilation: the PAT_* flags that aren't just
+ * about where the result is stored, the initial globbing flags and
+ * which special characters are active, which covers the options
+ * EXTENDED_GLOB, KSH_GLOB and SH_GLOB as well as disable -p.
+ *
+ * Patterns for files aren't cached, since they're compiled a
+ * segment at a time and depend on further options.
+ */
+
+#define PATCACHE_SIZE 64
+
+/* Flags that only say where the compiled pattern is stored */
+#define PAT_STORAGE_FLAGS (PAT_STATIC|PAT_ZDUP)
+
+struct patcachenode {
+    struct hashnode node;	/* node.nam is the key */
+    Patprog prog;		/* zalloc'ed copy of the programme */
+    long size;			/* size of the same */
+    zlong lastused;		/* for discarding the oldest */
+};
+
+static HashTable patcachetab;
+static zlong patcache_ticks;
+
+/* Counts of cache lookups and discarded nodes, shown by memstats */
+
+/**/
+mod_export zlong patcache_hits, patcache_misses, patcache_discards;
+
+/**/
+static void
+freepatcachenode(HashNode hn)
+{
+    struct patcachenode *pcn = (struct patcachenode *)hn;
+
+    zsfree(pcn->node.nam);
+    zfree(pcn->prog, pcn->size);
+    zfree(pcn, sizeof(*pcn));
+}
+
+/**/
+#ifdef ZSH_HASH_DEBUG
+
+/**/
+static void
+printpatcacheinfo(HashTable ht)
+{
+    printf("name of table   : patcachetab\n");
+    printf("number of nodes : %d (maximum %d)\n\n", ht->ct, PATCACHE_SIZE);
+    printf("cache hits      : %ld\n", (long)patcache_hits);
+    printf("cache misses    : %ld\n", (long)patcache_misses);
+    printf("nodes discarded : %ld\n", (long)patcache_discards);
+}
+
+/**/
+#endif /* ZSH_HASH_DEBUG */
+
+/*
+ * Make the cache key for a pattern.  zpc_special and patglobflags
+ * must already be set up for compiling it.
+ */
+
+/**/
+static char *
+patcachekey(char *exp, int inflags)
+{
+    char *key;
+    int i, active = 0;
+
+    for (i = 0; i < ZPC_COUNT; i++)
+	if (zpc_special[i] != Marker)
+	    active |= 1 << i;
+    key = (char *)zhalloc(strlen(exp) + 3 * DIGBUFSIZE);
+    sprintf(key, "%x:%x:%x:%s", inflags & ~PAT_STORAGE_FLAGS,
+	    patglobflags, active, exp);
+    return key;
+}
+
+/*
+ * Return a copy of a programme, stored as requested by the PAT_*
+ * flags in the same way as a newly compiled one.
+ */
+
+/**/
+static Patprog
+patcopyprog(Patprog prog, long size, int inflags)
+{
+    Patprog p;
+
+    if (inflags & PAT_ZDUP)
+	p = (Patprog)zalloc(size);
+    else if (inflags & PAT_STATIC) {
+	if (patalloc < size)
+	    patout = (char *)zrealloc(patout, patalloc = size);
+	p = (Patprog)patout;
+    } else
+	p = (Patprog)zhalloc(size);
+    memcpy((char *)p, (char *)prog, size);
+    return p;
+}
+
+/* Look up a compiled pattern in the cache. */
+
+/**/
+static Patprog
+patcacheget(char *key, int inflags)
+{
+    struct patcachenode *pcn;
+
+    if (!patcachetab ||
+	!(pcn = (struct patcachenode *)
+	  patcachetab->getnode(patcachetab, key))) {
+	patcache_misses++;
+	return NULL;
+    }
+    patcache_hits++;
+    pcn->lastused = ++patcache_ticks;
+    return patcopyprog(pcn->prog, pcn->size, inflags);
+}
+
+/* Add a newly compiled pattern to the cache. */
+
+/**/
+static void
+patcacheadd(char *key, Patprog prog, long size)
+{
+    struct patcachenode *pcn;
+
+    if (!patcachetab) {
+	patcachetab = newhashtable(PATCACHE_SIZE, "patcachetab",
+#ifdef ZSH_HASH_DEBUG
+				   printpatcacheinfo
+#else
+				   NULL
+#endif
+	    );
+
+	patcachetab->hash        = hasher;
+	patcachetab->emptytable  = emptyhashtable;
+	patcachetab->filltable   = NULL;
+	patcachetab->cmpnodes    = strcmp;
+	patcachetab->addnode     = addhashnode;
+	patcachetab->getnode     = gethashnode2;
+	patcachetab->getnode2    = gethashnode2;
+	patcachetab->removenode  = removehashnode;
+	patcachetab->disablenode = NULL;
+	patcachetab->enablenode  = NULL;
+	patcachetab->freenode    = freepatcachenode;
+	patcachetab->printnode   = NULL;
+    } else if (patcachetab->ct >= PATCACHE_SIZE) {
+	/* Discard the least recently used pattern. */
+	HashNode hn, oldest = NULL;
+	zlong oldtick = 0;
+	int i;
+
+	for (i = 0; i < patcachetab->hsize; i++)
+	    for (hn = patcachetab->nodes[i]; hn; hn = hn->next)
+		if (!oldest ||
+		    ((struct patcachenode *)hn)->lastused < oldtick) {
+		    oldest = hn;
+		    oldtick = ((struct patcachenode *)hn)->lastused;
+		}
+	patcachetab->freenode(patcachetab->removenode(patcachetab,
+						      oldest->nam));
+	patcache_discards++;
+    }
+    pcn = (struct patcachenode *)zshcalloc(sizeof(*pcn));
+    pcn->prog = (Patprog)zalloc(size);
+    memcpy((char *)pcn->prog, (char *)prog, size);
+    pcn->size = size;
+    pcn->lastused = ++patcache_ticks;
+    patcachetab->addnode(patcachetab, ztrdup(key), pcn);
+}
+
 /* Called before parsing a set of file matches to initialize flags */
 
 /**/
@@ -543,7 +723,7 @@ patcompile(char *exp, int inflags, char **endexp)
     long len = 0;
     long startoff;
     Upat pscan;
-    char *lng, *strp = NULL;
+    char *lng, *strp = NULL, *cachekey = NULL;
     Patprog p;
 
     queue_signals();
@@ -576,6 +756,13 @@ patcompile(char *exp, int inflags, char **endexp)
     }
     if (patflags & PAT_LCMATCHUC)
 	patglobflags |= GF_LCMATCHUC;
+    if (exp && !endexp && !(patflags & PAT_FILE)) {
+	cachekey = patcachekey(exp, inflags);
+	if ((p = patcacheget(cachekey, inflags))) {
+	    unqueue_signals();
+	    return p;
+	}
+    }
     /*
      * Have to be set now, since they get updated during compilation.
      */
@@ -706,23 +893,32 @@ patcompile(char *exp, int inflags, char **endexp)
 		p->patmlen = p->size - startoff;
 	    } else {
 		/* starting point info */
-		if (P_OP(pscan) == P_EXACTLY && !p->globflags &&
-		    P_LS_LEN(pscan))
+		if (P_OP(pscan) == P_EXACTLY &&
+		    !(p->globflags & ~GF_MULTIBYTE) && P_LS_LEN(pscan))
 		    p->patstartch = *P_LS_STR(pscan);
 		/*
-		 * Find the longest literal string in something expensive.
+		 * Find the longest literal string in something expensive,
+		 * i.e. something starting with a closure such as "*".
 		 * This is itself not all that cheap if we have
-		 * case-insensitive matching or approximation, so don't.
+		 * case-insensitive matching or approximation, so don't;
+		 * that includes flags turned on part of the way through.
+		 * The search is for bytes of the metafied string, so
+		 * multibyte mode doesn't matter.
 		 */
-		if ((flags & P_HSTART) && !p->globflags) {
+		if ((flags & P_HSTART) && !(p->globflags & ~GF_MULTIBYTE)) {
 		    lng = NULL;
 		    len = 0;
-		    for (; pscan; pscan = PATNEXT(pscan))
+		    for (; pscan; pscan = PATNEXT(pscan)) {
+			if (P_OP(pscan) == P_GFLAGS) {
+			    lng = NULL;
+			    break;
+			}
 			if (P_OP(pscan) == P_EXACTLY &&
 			    P_LS_LEN(pscan) >= len) {
 			    lng = P_LS_STR(pscan);
 			    len = P_LS_LEN(pscan);
 			}
+		    }
 		    if (lng) {
 			p->mustoff = lng - patout;
 			p->patmlen = len;
@@ -751,6 +947,9 @@ patcompile(char *exp, int inflags, char **endexp)
     if (endexp)
 	*endexp = patparse;
 
+    if (cachekey)
+	patcacheadd(cachekey, p, patsize);
+
     unqueue_signals();
     return p;
 }
@@ -1433,6 +1632,7 @@ patcomppiece(int *flagp, int paren)
 		  "Treating '*' as pattern character although disabled");
 	    /* kshchar is used as a sign that we can't have #'s. */
 	    kshchar = -1;
+	    flags |= P_HSTART;
 	    starter = patnode(P_STAR);
 	    break;
 	case Inbrack:
@@ -2214,6 +2414,35 @@ char *patallocstr(Patprog prog, char *string, int stringlen, int unmetalen,
 }
 
 
+/*
+ * Find the literal string pat of length patlen in str of length len,
+ * neither of which need be null-terminated.  memchr() finds the
+ * places where the first character occurs, which is much faster
+ * than comparing at every position.  Returns a pointer to the
+ * match or NULL.
+ */
+
+/**/
+mod_export char *
+patfindstr(char *str, int len, char *pat, int patlen)
+{
+    char *end;
+
+    if (!patlen)
+	return str;
+    if (patlen > len)
+	return NULL;
+    end = str + len - patlen;
+    while (str <= end) {
+	if (!(str = memchr(str, *pat, end - str + 1)))
+	    return NULL;
+	if (!memcmp(str, pat, patlen))
+	    return str;
+	str++;
+    }
+    return NULL;
+}
+
 /*
  * Test prog against null-terminated, metafied string.
  */
@@ -2454,29 +2683,9 @@ pattryrefs(Patprog prog, char *string, int stringlen, int unmetalenin,
 	ret = 1;
 	if (!(prog->flags & PAT_SCAN) && prog->mustoff)
 	{
-	    char *testptr;	/* start pointer into test string */
-	    char *teststop;	/* last point from which we can match */
-	    char *patptr = (char *)prog + prog->mustoff;
-	    int patlen = prog->patmlen;
-	    int found = 0;
-
-	    if (patlen > stringlen) {
-		/* Too long, can't match. */
+	    if (!patfindstr(patinstart, stringlen,
+			    (char *)prog + prog->mustoff, prog->patmlen))
 		ret = 0;
-	    } else {
-		teststop = patinend - patlen;
-
-		for (testptr = patinstart; testptr <= teststop; testptr++)
-		{
-		    if (!memcmp(testptr, patptr, patlen)) {
-			found = 1;
-			break;
-		    }
-		}
-
-		if (!found)
-		    ret = 0;
-	    }
 	}
 	if (!ret)
 	    return 0;
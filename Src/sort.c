@@ -39,6 +39,15 @@ static int sortnobslash;
 /* Flag that sort is numeric */
 static int sortnumeric;
 
+/* Flag that comparison strings are collation keys from zstrxfrm() */
+static int sortxfrm;
+
+/*
+ * Minimum number of elements for which it's worth transforming
+ * each string once rather than calling strcoll() on every comparison.
+ */
+#define SORT_XFRM_MIN 16
+
 /**/
 static int
 eltpcmp(const void *a, const void *b)
@@ -49,6 +58,9 @@ eltpcmp(const void *a, const void *b)
     const char *ao = as;
     int cmp;
 
+    if (sortxfrm)
+	return sortdir * strcmp(as, bs);
+
     if (ae->len != -1 || be->len != -1) {
 	/*
 	 * Length recorded.  We only do that if there are embedded
@@ -220,6 +232,36 @@ zstrcmp(const char *as, const char *bs, int sortflags)
 }
 
 
+/*
+ * Return a collation key for the unmetafied string s, such that
+ * comparing two keys with strcmp() orders them as strcoll() would
+ * order the original strings.  The key is allocated on the heap.
+ * Returns NULL if the system can't transform strings, in which
+ * case the caller should compare the strings directly.
+ */
+
+/**/
+mod_export char *
+zstrxfrm(const char *s)
+{
+#if defined(HAVE_STRCOLL) && defined(HAVE_STRXFRM)
+    static char *buf;
+    static size_t bufsz;
+    size_t len;
+
+    if (!bufsz)
+	buf = (char *)zalloc(bufsz = 256);
+    while ((len = strxfrm(buf, s, bufsz)) >= bufsz) {
+	zfree(buf, bufsz);
+	buf = (char *)zalloc(bufsz = len + 1);
+    }
+    return dupstring(buf);
+#else
+    return NULL;
+#endif
+}
+
+
 /*
  * Sort an array of metafied strings.  Use an "or" of bit flags
  * to decide how to sort.  See the SORTIT_* flags in zsh.h.
@@ -404,8 +446,28 @@ strmetasort(char **array, int sortwhat, int *unmetalenp)
     sortnumeric = (sortwhat & SORTIT_NUMERICALLY_SIGNED) ? -1 :
 	(sortwhat & SORTIT_NUMERICALLY) ? 1 : 0;
 
+    /*
+     * For larger sorts with no embedded nulls or numeric comparisons,
+     * transform each string once so that the comparisons are plain
+     * strcmp() rather than strcoll().
+     */
+    sortxfrm = 0;
+    if (!sortnumeric && nsort >= SORT_XFRM_MIN) {
+	char *key;
+	int i;
+	for (i = 0; i < nsort && sortarr[i].len == -1; i++)
+	    ;
+	if (i == nsort && (key = zstrxfrm(sortarr[0].cmp))) {
+	    sortarr[0].cmp = key;
+	    for (i = 1; i < nsort; i++)
+		sortarr[i].cmp = zstrxfrm(sortarr[i].cmp);
+	    sortxfrm = 1;
+	}
+    }
+
     qsort(sortptrarr, nsort, sizeof(SortElt), eltpcmp);
 
+    sortxfrm = 0;
     sortnumeric = oldsortnumeric;
     sortdir = oldsortdir;
     for (arrptr = array, sortptrarrptr = sortptrarr; nsort--; ) {
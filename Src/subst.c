@@ -319,10 +319,12 @@ stringsubst(LinkList list, LinkNode node, int pf_flags, int *ret_flags,
 		     !(pf_flags & PREFORK_NOSHWORDSPLIT)) ||
 		    (pf_flags & PREFORK_SPLIT))
 		    pf_flags |= PREFORK_SHWORDSPLIT;
+		runhookdef(EXPANDSTARTHOOK, "param");
 		node = paramsubst(
 		    list, node, &str, qt,
 		    pf_flags & (PREFORK_SINGLE|PREFORK_SHWORDSPLIT|
 				PREFORK_SUBEXP), ret_flags);
+		runhookdef(EXPANDENDHOOK, "param");
 		if (errflag || !node)
 		    return NULL;
 		str3 = (char *)getdata(node);
@@ -396,8 +398,10 @@ stringsubst(LinkList list, LinkNode node, int pf_flags, int *ret_flags,
 		       (qt && str[1] == '"'))))
 		    *str = ztokens[c - Pound];
 	    str++;
-	    if (!(pl = getoutput(str2 + 1, qt ||
-				 (pf_flags & PREFORK_SINGLE)))) {
+	    runhookdef(EXPANDSTARTHOOK, "cmdsubst");
+	    pl = getoutput(str2 + 1, qt || (pf_flags & PREFORK_SINGLE));
+	    runhookdef(EXPANDENDHOOK, "cmdsubst");
+	    if (!pl) {
 		zerr("parse error in command substitution");
 		return NULL;
 	    }
@@ -498,7 +502,9 @@ globlist(LinkList list, int flags)
 	    /* Skip key / value pair */
 	    next = nextnode(nextnode(next));
 	} else {
+	    runhookdef(EXPANDSTARTHOOK, "glob");
 	    zglob(list, node, (flags & PREFORK_NO_UNTOK) != 0);
+	    runhookdef(EXPANDENDHOOK, "glob");
 	}
     }
     if (noerrs)
@@ -2831,9 +2837,10 @@ paramsubst(LinkList l, LinkNode n, char **str, int qt, int pf_flags,
 	    }
 	    pm = createparam(nulstring, isarr ? PM_ARRAY : PM_SCALAR);
 	    DPUTS(!pm, "BUG: parameter not created");
-	    if (isarr)
+	    if (isarr) {
 		pm->u.arr = aval;
-	    else
+		pm->asize = 0;
+	    } else
 		pm->u.str = val;
 	    v = (Value) hcalloc(sizeof *v);
 	    v->isarr = isarr;
@@ -426,12 +426,22 @@ putraw(int c)
     return 0;
 }
 
+/*
+ * Number of bytes output by putshout().  ZLE also adds the bytes it
+ * writes to shout directly, so that it can tell how much output a
+ * redisplay produced.
+ */
+
+/**/
+mod_export zlong shoutbytes;
+
 /* Output a single character, for the termcap routines. */
 
 /**/
 mod_export int
 putshout(int c)
 {
+    shoutbytes++;
     putc(c, shout);
     return 0;
 }
@@ -2980,6 +2990,28 @@ noquery(int purge)
     return val;
 }
 
+/*
+ * Non-zero while an operation, such as generating completions, is to be
+ * abandoned if the user types something.  The value is one more than the
+ * number of bytes that were already waiting when the operation started;
+ * checkinputcancel() sets it to -1 when it interrupts the operation.
+ */
+
+/**/
+mod_export int inputcancel;
+
+/* Interrupt the current operation if input has arrived; see inputcancel. */
+
+/**/
+mod_export void
+checkinputcancel(void)
+{
+    if (inputcancel > 0 && noquery(0) >= inputcancel) {
+	inputcancel = -1;
+	errflag |= ERRFLAG_INT;
+    }
+}
+
 /**/
 int
 getquery(char *valid_chars, int purge)
@@ -5186,6 +5218,20 @@ ztrsub(char const *t, char const *s)
 /**/
 mod_export char *
 zreaddir(DIR *dir, int ignoredots)
+{
+    return zreaddirtype(dir, ignoredots, NULL);
+}
+
+/*
+ * As zreaddir(), but if typep is not NULL also set *typep to the
+ * type of the file in the form of the S_IFMT bits of a stat mode,
+ * if the system tells us that without a stat(), else to 0.
+ * Note that a symbolic link is reported as such.
+ */
+
+/**/
+mod_export char *
+zreaddirtype(DIR *dir, int ignoredots, mode_t *typep)
 {
     struct dirent *de;
 #if defined(HAVE_ICONV) && defined(__APPLE__)
@@ -5202,6 +5248,44 @@ zreaddir(DIR *dir, int ignoredots)
     } while(ignoredots && de->d_name[0] == '.' &&
 	(!de->d_name[1] || (de->d_name[1] == '.' && !de->d_name[2])));
 
+    if (typep) {
+#ifdef HAVE_STRUCT_DIRENT_D_TYPE
+	switch (de->d_type) {
+	case DT_DIR:
+	    *typep = S_IFDIR;
+	    break;
+	case DT_REG:
+	    *typep = S_IFREG;
+	    break;
+	case DT_LNK:
+	    *typep = S_IFLNK;
+	    break;
+# ifdef S_IFIFO
+	case DT_FIFO:
+	    *typep = S_IFIFO;
+	    break;
+# endif
+# ifdef S_IFSOCK
+	case DT_SOCK:
+	    *typep = S_IFSOCK;
+	    break;
+# endif
+	case DT_CHR:
+	    *typep = S_IFCHR;
+	    break;
+	case DT_BLK:
+	    *typep = S_IFBLK;
+	    break;
+	default:
+	    /* DT_UNKNOWN: the file system doesn't tell us */
+	    *typep = 0;
+	    break;
+	}
+#else
+	*typep = 0;
+#endif
+    }
+
 #if defined(HAVE_ICONV) && defined(__APPLE__)
     if (!conv_ds)
 	conv_ds = iconv_open("UTF-8", "UTF-8-MAC");
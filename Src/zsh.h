@@ -1859,6 +1859,14 @@ struct param {
     char *ename;		/* name of corresponding environment var */
     Param old;			/* old struct for use with local         */
     int level;			/* if (old != NULL), level of localness  */
+    /*
+     * For plain arrays that have been appended to, the length of u.arr
+     * and the number of slots allocated for it; asize is zero if these
+     * are not known.  arrsetfn() resets asize, and anything else that
+     * replaces u.arr or shortens it in place must do so too.
+     */
+    int alen;
+    int asize;
 };
 
 /* structure stored in struct param's u.data by tied arrays */
@@ -2230,6 +2238,9 @@ enum noerrexit_bits {
 
 /* history entry */
 
+/* Words of bits in the trigram signature of a history line */
+#define HIST_TRIGRAM_WORDS 4
+
 struct histent {
     struct hashnode node;
 
@@ -2246,6 +2257,8 @@ struct histent {
 				/*   line:  as pairs of start, end  */
     int nwords;			/* Number of words in history line  */
     zlong histnum;		/* A sequential history number      */
+    unsigned int trigrams[HIST_TRIGRAM_WORDS];
+				/* Signature of the text for searches */
 };
 
 #define HIST_MAKEUNIQUE	0x00000001	/* Kill this new entry if not unique */
@@ -2255,6 +2268,7 @@ struct histent {
 #define HIST_FOREIGN	0x00000010	/* Command came from another shell */
 #define HIST_TMPSTORE	0x00000020	/* Kill when user enters another cmd */
 #define HIST_NOWRITE	0x00000040	/* Keep internally but don't write */
+#define HIST_TRIGRAMS	0x00000080	/* trigrams is set for the text */
 
 #define GETHIST_UPWARD  (-1)
 #define GETHIST_DOWNWARD  1
@@ -2400,6 +2414,7 @@ enum {
     APPENDCREATE,
     COMBININGCHARS,
     COMPLETEALIASES,
+    COMPLETECANCELONINPUT,
     COMPLETEINWORD,
     CORRECT,
     CORRECTALL,
@@ -2901,6 +2916,20 @@ struct heap {
 # define NEWHEAPS(h)    do { Heap _switch_oldheaps = h = new_heaps(); do
 # define OLDHEAPS       while (0); old_heaps(_switch_oldheaps); } while (0);
 
+/* Counters kept by the heap allocator, see mem.c. */
+
+struct heapstats {
+    zlong arenas;		/* arenas obtained from the system           */
+    zlong reused;		/* arenas taken from the free list instead   */
+    zlong freed;		/* arenas given back to the system           */
+    zlong bytes;		/* bytes held in arenas, including free ones */
+    zlong peak;			/* highest value of bytes                    */
+    zlong copies;		/* hrealloc() calls that had to copy         */
+    zlong slabnew;		/* slaballoc() calls that used zalloc()      */
+    zlong slabreused;		/* slaballoc() calls that reused a block     */
+    zlong slabcached;		/* freed blocks kept by slabfree()           */
+};
+
 # define SWITCHHEAPS(o, h)  do { o = switch_heaps(h); do
 # define SWITCHBACKHEAPS(o) while (0); switch_heaps(o); } while (0);
 
@@ -3254,6 +3283,9 @@ enum zexit_t {
 #define BEFORETRAPHOOK (zshhooks + 1)
 #define AFTERTRAPHOOK  (zshhooks + 2)
 #define GETCOLORATTR   (zshhooks + 3)
+#define EXECLINEHOOK   (zshhooks + 4)
+#define EXPANDSTARTHOOK (zshhooks + 5)
+#define EXPANDENDHOOK  (zshhooks + 6)
 
 /* Final argument to [ms]b_niceformat() */
 enum {
@@ -170,6 +170,7 @@ char *alloca _((size_t));
 # define dirent direct
 # undef HAVE_STRUCT_DIRENT_D_INO
 # undef HAVE_STRUCT_DIRENT_D_STAT
+# undef HAVE_STRUCT_DIRENT_D_TYPE
 # ifdef HAVE_STRUCT_DIRECT_D_INO
 #  define HAVE_STRUCT_DIRENT_D_INO HAVE_STRUCT_DIRECT_D_INO
 # endif
@@ -336,6 +337,10 @@ struct timespec {
  * need to undef and then redefine the wait macros if <sys/wait.h> *
  * is not POSIX.                                                   */
 
+#ifdef USE_POSIX_SPAWN
+# include <spawn.h>
+#endif
+
 #ifdef HAVE_SYS_WAIT_H
 # include <sys/wait.h>
 #else